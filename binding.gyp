@@ -6,13 +6,26 @@
           "src/player.cc",
           "src/groove.cc",
           "src/file.cc",
+          "src/file_io.cc",
+          "src/file_pool.cc",
+          "src/metadata_cache.cc",
           "src/playlist.cc",
           "src/playlist_item.cc",
           "src/waveform_builder.cc",
+          "src/null_sink.cc",
           "src/loudness_detector.cc",
           "src/fingerprinter.cc",
           "src/encoder.cc",
           "src/device.cc",
+          "src/device_watcher.cc",
+          "src/stream_writer.cc",
+          "src/scheduler.cc",
+          "src/batch_runner.cc",
+          "src/cancel_token.cc",
+          "src/tag_writer.cc",
+          "src/position_view.cc",
+          "src/event_dispatcher.cc",
+          "src/env.cc",
         ],
         "libraries": [
             "-lgroove"
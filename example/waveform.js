@@ -6,11 +6,14 @@ main();
 
 function main() {
   var inputFilename = null;
+  var overrideDuration = null;
+  var exactDuration = false;
 
   for (var i = 2; i < process.argv.length; i += 1) {
     var arg = process.argv[i];
-    var overrideDuration = null;
-    if (arg[0] === "-" && arg[1] === "-") {
+    if (arg === "--exact-duration") {
+      exactDuration = true;
+    } else if (arg[0] === "-" && arg[1] === "-") {
       if (++i < process.argv.length) {
         if (arg === "--override-duration") {
           overrideDuration = parseFloat(process.argv[i]);
@@ -40,7 +43,8 @@ function main() {
       return;
     }
     if (Math.abs(info.expectedDuration - info.actualDuration) > 0.1) {
-      console.error("invalid duration. re-run with --override-duration " + info.actualDuration);
+      console.error("invalid duration. re-run with --exact-duration or --override-duration " +
+          info.actualDuration);
       process.exit(1);
       return;
     }
@@ -59,11 +63,22 @@ function main() {
       file.overrideDuration(overrideDuration);
     }
 
+    if (exactDuration) {
+      file.computeExactDuration(function(err) {
+        if (err) throw err;
+        start();
+      });
+    } else {
+      start();
+    }
+  });
+
+  function start() {
     playlist.insert(file, null);
     waveform.attach(playlist, function(err) {
       if (err) throw err;
     });
-  });
+  }
 
   function cleanup() {
     playlist.clear();
@@ -78,7 +93,7 @@ function main() {
 }
 
 function usageAndExit() {
-  console.error("Usage: node waveform.js [--override-duration seconds] file");
+  console.error("Usage: node waveform.js [--exact-duration] [--override-duration seconds] file");
   process.exit(1);
 }
 
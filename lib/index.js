@@ -17,17 +17,64 @@ var bindingsCreateLoudnessDetector = bindings.createLoudnessDetector;
 var bindingsCreateFingerprinter = bindings.createFingerprinter;
 var bindingsCreateEncoder = bindings.createEncoder;
 var bindingsCreateWaveformBuilder = bindings.createWaveformBuilder;
+var bindingsCreateNullSink = bindings.createNullSink;
+var bindingsScan = bindings.scan;
+var bindingsWriteTags = bindings.writeTags;
+var bindingsOpenStream = bindings.openStream;
+var bindingsCreateFilePool = bindings.createFilePool;
+var bindingsCreatePlaylist = bindings.createPlaylist;
 
 bindings.createPlayer = jsCreatePlayer;
 bindings.createEncoder = jsCreateEncoder;
 bindings.createLoudnessDetector = jsCreateLoudnessDetector;
 bindings.createFingerprinter = jsCreateFingerprinter;
 bindings.createWaveformBuilder = jsCreateWaveformBuilder;
+bindings.createNullSink = jsCreateNullSink;
+bindings.scan = jsScan;
+bindings.writeTags = jsWriteTags;
+bindings.openStream = jsOpenStream;
+bindings.createFilePool = jsCreateFilePool;
+bindings.createPlaylist = jsCreatePlaylist;
+bindings.readPositionView = readPositionView;
 bindings.loudnessToReplayGain = loudnessToReplayGain;
 bindings.dBToFloat = dBToFloat;
 
+// the module itself emits 'devicesChanged'
+Object.keys(EventEmitter.prototype).forEach(function(method) {
+  bindings[method] = EventEmitter.prototype[method];
+});
+EventEmitter.call(bindings);
+bindings._setDevicesChangedCallback(onDevicesChanged);
+
 module.exports = bindings;
 
+function onDevicesChanged(oldDevices, newDevices) {
+  var oldList = oldDevices ? oldDevices.list : [];
+  var newList = newDevices ? newDevices.list : [];
+  var oldDefault = (oldDevices && oldList[oldDevices.defaultIndex]) || null;
+  var newDefault = (newDevices && newList[newDevices.defaultIndex]) || null;
+  bindings.emit('devicesChanged', {
+    added: devicesMissingFrom(newList, oldList),
+    removed: devicesMissingFrom(oldList, newList),
+    defaultChanged: !sameDevice(oldDefault, newDefault),
+    devices: newDevices,
+  });
+}
+
+// the devices in list which are not in other
+function devicesMissingFrom(list, other) {
+  return list.filter(function(device) {
+    return !other.some(function(otherDevice) {
+      return sameDevice(device, otherDevice);
+    });
+  });
+}
+
+function sameDevice(a, b) {
+  if (!a || !b) return a === b;
+  return a.id === b.id && a.isRaw === b.isRaw;
+}
+
 function jsCreateEncoder() {
   var encoder = bindingsCreateEncoder(eventCb);
 
@@ -41,41 +88,120 @@ function jsCreateEncoder() {
   }
 }
 
-function jsCreatePlayer() {
-  var player = bindingsCreatePlayer(eventCb);
+function jsCreatePlayer(options) {
+  options = options || {};
+  var player = bindingsCreatePlayer(options.coalesceEvents ? batchCb : eventCb, options);
 
   postHocInherit(player, EventEmitter);
   EventEmitter.call(player);
 
+  if (options.deviceFailover) enableDeviceFailover(player);
+
   return player;
 
   function eventCb(id) {
-    switch (id) {
-    case bindings._EVENT_NOWPLAYING:
-      player.emit('nowPlaying');
-      break;
-    case bindings._EVENT_BUFFERUNDERRUN:
-      player.emit('bufferUnderrun');
-      break;
-    case bindings._EVENT_DEVICE_CLOSED:
-      player.emit('deviceClosed');
-      break;
-    case bindings._EVENT_DEVICE_OPENED:
-      player.emit('deviceOpened');
-      break;
-    case bindings._EVENT_DEVICE_OPEN_ERROR:
-      player.emit('deviceOpenError');
-      break;
-    case bindings._EVENT_END_OF_PLAYLIST:
-      player.emit('endOfPlaylist');
-      break;
-    case bindings._EVENT_WAKEUP:
-      player.emit('wakeup');
-      break;
+    var name = playerEventName(id);
+    if (name) player.emit(name);
+  }
+
+  function batchCb(batch) {
+    var events = new Array(batch.length / 3);
+    for (var i = 0; i < events.length; i += 1) {
+      events[i] = {
+        type: playerEventName(batch[i * 3]),
+        time: batch[i * 3 + 1],
+        itemId: batch[i * 3 + 2],
+      };
     }
+    player.emit('events', events);
   }
 }
 
+// While attached, if the player's device goes away, move the player to the
+// default device and pick up from the play head.
+function enableDeviceFailover(player) {
+  var attach = player.attach;
+  var detach = player.detach;
+  var playlist = null;
+  var failingOver = false;
+
+  player.attach = function() {
+    var args = Array.prototype.slice.call(arguments);
+    var target = args[0];
+    var cb = args[args.length - 1];
+    args[args.length - 1] = function(err) {
+      if (!err) {
+        playlist = target;
+        bindings.on('devicesChanged', onDevicesChanged);
+      }
+      cb(err);
+    };
+    return attach.apply(player, args);
+  };
+
+  player.detach = function(cb) {
+    stopWatching();
+    return detach.call(player, cb);
+  };
+
+  function stopWatching() {
+    if (playlist) bindings.removeListener('devicesChanged', onDevicesChanged);
+    playlist = null;
+  }
+
+  function onDevicesChanged(change) {
+    if (!playlist || failingOver) return;
+    var lost = change.removed.some(function(device) {
+      return sameDevice(device, player.device);
+    });
+    if (!lost || !change.devices || change.devices.defaultIndex < 0) return;
+
+    var target = playlist;
+    var position = player.position();
+    failingOver = true;
+    detach.call(player, function(err) {
+      if (err) {
+        failingOver = false;
+        return;
+      }
+      player.device = change.devices.list[change.devices.defaultIndex];
+      attach.call(player, target, function(err) {
+        failingOver = false;
+        if (err) {
+          stopWatching();
+          player.emit('deviceOpenError');
+          return;
+        }
+        // the audio buffered for the old device was lost; decode it again
+        if (position.item && target.indexOf(position.item) >= 0) {
+          target.seek(position.item, position.pos);
+        }
+        player.emit('deviceFailover', player.device);
+      });
+    });
+  }
+}
+
+function playerEventName(id) {
+  switch (id) {
+  case bindings._EVENT_NOWPLAYING:
+    return 'nowPlaying';
+  case bindings._EVENT_BUFFERUNDERRUN:
+    return 'bufferUnderrun';
+  case bindings._EVENT_DEVICE_CLOSED:
+    return 'deviceClosed';
+  case bindings._EVENT_DEVICE_OPENED:
+    return 'deviceOpened';
+  case bindings._EVENT_DEVICE_OPEN_ERROR:
+    return 'deviceOpenError';
+  case bindings._EVENT_END_OF_PLAYLIST:
+    return 'endOfPlaylist';
+  case bindings._EVENT_WAKEUP:
+    return 'wakeup';
+  }
+  return null;
+}
+
 function jsCreateLoudnessDetector() {
   var detector = bindingsCreateLoudnessDetector(eventCb);
 
@@ -114,6 +240,187 @@ function jsCreateWaveformBuilder() {
   }
 }
 
+function jsCreateNullSink() {
+  var sink = bindingsCreateNullSink(eventCb);
+
+  postHocInherit(sink, EventEmitter);
+  EventEmitter.call(sink);
+
+  return sink;
+
+  function eventCb(id) {
+    var name = playerEventName(id);
+    if (name) sink.emit(name);
+  }
+}
+
+function jsScan(paths, options, onResult, callback) {
+  if (typeof options === 'function') {
+    callback = onResult;
+    onResult = options;
+    options = null;
+  }
+  bindingsScan(paths, options || {}, onResult, callback || noop);
+}
+
+function jsWriteTags(jobs, options, onProgress, callback) {
+  if (typeof options === 'function') {
+    callback = onProgress;
+    onProgress = options;
+    options = null;
+  }
+  bindingsWriteTags(jobs, options || {}, onProgress, callback || noop);
+}
+
+function jsOpenStream(readable, formatHint, options, callback) {
+  if (typeof options === 'function') {
+    callback = options;
+    options = null;
+  }
+  var pending = null;
+  var ended = false;
+  var streamError = null;
+  var writer = bindingsOpenStream(formatHint, options || {}, onDrain, onOpen);
+
+  readable.on('data', onData);
+  readable.on('end', onEnd);
+  readable.on('error', onError);
+
+  function onOpen(err, file) {
+    if (!streamError) return callback(err, file);
+    // the open most likely failed because of the stream error
+    if (err) return callback(streamError);
+    // enough arrived to open it, but the rest never will
+    file.close(function() {
+      callback(streamError);
+    });
+  }
+
+  function onData(chunk) {
+    if (pending) {
+      pending = Buffer.concat([pending, chunk]);
+      return;
+    }
+    var written = writer.write(chunk);
+    if (written < chunk.length) {
+      // the native buffer is full. wait for the decoder to catch up.
+      pending = chunk.slice(written);
+      readable.pause();
+    }
+  }
+
+  function onDrain() {
+    if (!pending) return;
+    var written = writer.write(pending);
+    if (written < pending.length) {
+      pending = pending.slice(written);
+      return;
+    }
+    pending = null;
+    if (ended) {
+      writer.end();
+    } else {
+      readable.resume();
+    }
+  }
+
+  function onEnd() {
+    if (ended) return;
+    ended = true;
+    if (!pending) writer.end();
+  }
+
+  function onError(err) {
+    if (streamError) return;
+    streamError = err;
+    ended = true;
+    pending = null;
+    writer.abort();
+  }
+}
+
+function jsCreateFilePool(options) {
+  var pool = bindingsCreateFilePool(options || {});
+  var proto = Object.getPrototypeOf(pool);
+  if (!proto.open) proto.open = filePoolOpen;
+  return pool;
+}
+
+function filePoolOpen(filename, callback) {
+  var file = this._acquire(filename);
+  if (file) {
+    process.nextTick(function() {
+      callback(null, file);
+    });
+    return;
+  }
+  this._open(filename, callback);
+}
+
+function jsCreatePlaylist() {
+  var playlist = bindingsCreatePlaylist();
+  var proto = Object.getPrototypeOf(playlist);
+  if (!proto.iterateItems) {
+    proto.iterateItems = playlistIterateItems;
+    if (typeof Symbol === 'function' && Symbol.iterator) {
+      proto[Symbol.iterator] = playlistIterateItems;
+    }
+  }
+  return playlist;
+}
+
+function playlistIterateItems(pageSize) {
+  var playlist = this;
+  pageSize = pageSize || 64;
+  var page = [];
+  var pageIndex = 0;
+  var nextIndex = 0;
+  var lastItem = null;
+  var version = playlist.version;
+  var iterator = {next: next};
+  if (typeof Symbol === 'function' && Symbol.iterator) {
+    iterator[Symbol.iterator] = function() { return iterator; };
+  }
+  return iterator;
+
+  function next() {
+    if (playlist.version !== version) {
+      // carry on after the last item we returned, wherever it is now
+      version = playlist.version;
+      page = [];
+      pageIndex = 0;
+      if (lastItem) {
+        var index = playlist.indexOf(lastItem);
+        if (index === -1) throw new Error("playlist item removed during iteration");
+        nextIndex = index + 1;
+      }
+    }
+    if (pageIndex >= page.length) {
+      page = playlist.itemsRange(nextIndex, pageSize);
+      pageIndex = 0;
+      if (page.length === 0) return {value: undefined, done: true};
+    }
+    lastItem = page[pageIndex];
+    pageIndex += 1;
+    nextIndex += 1;
+    return {value: lastItem, done: false};
+  }
+}
+
+// Position views are written by a native thread while they are read here,
+// and JavaScript has no way to wait for a write to finish, so the fields may
+// come from different updates.
+function readPositionView(view, out) {
+  out = out || {};
+  out.pos = view[1];
+  out.itemId = view[2];
+  out.playing = view[3] === 1;
+  out.buffered = view[4];
+  return out;
+}
+
+function noop() {}
+
 function postHocInherit(baseInstance, Super) {
   var baseProto = Object.getPrototypeOf(baseInstance);
   var superProto = Super.prototype;
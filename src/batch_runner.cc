@@ -0,0 +1,170 @@
+#include "batch_runner.h"
+#include "env.h"
+
+using namespace v8;
+
+struct Batch {
+    uv_async_t async;
+    uv_mutex_t mutex;
+    std::vector<void *> jobs;
+    GNBatchRunFn run;
+    GNBatchResultFn result;
+    GNBatchDestroyFn destroy;
+    int batch_size;
+    GNPriority priority;
+    Nan::Callback *result_cb;
+    Nan::Callback *done_cb;
+    // these are only touched on the main thread
+    size_t next_index;
+    int running;
+    // guarded by mutex
+    std::vector<void *> finished;
+};
+
+static void batch_queue_next(Batch *batch);
+
+// Runs a single job of the batch. The next job is only queued once this one
+// is done, so a batch never has more than concurrency jobs waiting in the
+// scheduler's queues, and other work queued in the meantime gets its turn
+// between jobs instead of behind the whole batch.
+class BatchWorker : public Nan::AsyncWorker {
+public:
+    BatchWorker(Batch *batch, void *job) : Nan::AsyncWorker(NULL) {
+        this->batch = batch;
+        this->job = job;
+    }
+    ~BatchWorker() { }
+
+    void Execute() {
+        batch->run(job);
+
+        uv_mutex_lock(&batch->mutex);
+        batch->finished.push_back(job);
+        // only wake up the event loop once per batch
+        if ((int)batch->finished.size() >= batch->batch_size)
+            uv_async_send(&batch->async);
+        uv_mutex_unlock(&batch->mutex);
+    }
+
+    void HandleOKCallback() {
+        // the batch reports its results through its own async
+        batch_queue_next(batch);
+    }
+
+    Batch *batch;
+    void *job;
+};
+
+static void batch_queue_next(Batch *batch) {
+    if (batch->next_index < batch->jobs.size()) {
+        void *job = batch->jobs[batch->next_index++];
+        scheduler_queue(new BatchWorker(batch, job), batch->priority);
+        return;
+    }
+    batch->running -= 1;
+    if (batch->running == 0)
+        uv_async_send(&batch->async);
+}
+
+static void BatchCloseCb(uv_handle_t *handle) {
+    Batch *batch = reinterpret_cast<Batch *>(handle->data);
+    uv_mutex_destroy(&batch->mutex);
+    for (size_t i = 0; i < batch->jobs.size(); i += 1) {
+        batch->destroy(batch->jobs[i]);
+    }
+    delete batch->result_cb;
+    delete batch->done_cb;
+    delete batch;
+}
+
+static void BatchAsyncCb(uv_async_t *handle) {
+    Nan::HandleScope scope;
+
+    Batch *batch = reinterpret_cast<Batch *>(handle->data);
+
+    std::vector<void *> finished;
+    uv_mutex_lock(&batch->mutex);
+    finished.swap(batch->finished);
+    uv_mutex_unlock(&batch->mutex);
+    bool done = (batch->running == 0);
+
+    if (finished.size() > 0) {
+        Local<Array> results = Nan::New<Array>(finished.size());
+        for (size_t i = 0; i < finished.size(); i += 1) {
+            Nan::Set(results, i, batch->result(finished[i]));
+        }
+
+        Local<Value> argv[] = {results};
+        TryCatch try_catch;
+        batch->result_cb->Call(1, argv);
+
+        if (try_catch.HasCaught()) {
+            node::FatalException(try_catch);
+        }
+    }
+
+    if (!done)
+        return;
+
+    Local<Value> argv[] = {Nan::Null()};
+    TryCatch try_catch;
+    batch->done_cb->Call(1, argv);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+
+    uv_close(reinterpret_cast<uv_handle_t*>(&batch->async), BatchCloseCb);
+}
+
+void batch_run(const std::vector<void *> &jobs, int concurrency, int batch_size,
+        GNPriority priority, GNBatchRunFn run, GNBatchResultFn result,
+        GNBatchDestroyFn destroy, Nan::Callback *result_cb, Nan::Callback *done_cb)
+{
+    Batch *batch = new Batch;
+    batch->jobs = jobs;
+    batch->run = run;
+    batch->result = result;
+    batch->destroy = destroy;
+    batch->batch_size = batch_size;
+    batch->priority = priority;
+    batch->result_cb = result_cb;
+    batch->done_cb = done_cb;
+    batch->next_index = 0;
+
+    uv_mutex_init(&batch->mutex);
+    batch->async.data = batch;
+    uv_async_init(env_loop(), &batch->async, BatchAsyncCb);
+
+    // leave a thread free for interactive work which is not part of the
+    // batch, such as opening the song the user just picked
+    int thread_count = scheduler_get_thread_count();
+    if (priority == GNPriorityInteractive && thread_count > 1 && concurrency >= thread_count)
+        concurrency = thread_count - 1;
+    if ((size_t)concurrency > jobs.size())
+        concurrency = (int)jobs.size();
+
+    // nothing to do; still report completion asynchronously
+    batch->running = concurrency;
+    if (concurrency == 0) {
+        uv_async_send(&batch->async);
+        return;
+    }
+    for (int i = 0; i < concurrency; i += 1) {
+        void *job = batch->jobs[batch->next_index++];
+        scheduler_queue(new BatchWorker(batch, job), priority);
+    }
+}
+
+bool batch_get_concurrency(Local<Object> options, int *concurrency) {
+    *concurrency = 4;
+    Local<Value> concurrencyValue = options->Get(Nan::New<String>("concurrency").ToLocalChecked());
+    if (!concurrencyValue->IsNull() && !concurrencyValue->IsUndefined()) {
+        *concurrency = (int)concurrencyValue->NumberValue();
+    }
+    if (*concurrency < 1) {
+        Nan::ThrowTypeError("Expected concurrency to be at least 1");
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#ifndef GN_BATCH_RUNNER_H
+#define GN_BATCH_RUNNER_H
+
+#include <node.h>
+#include <nan.h>
+#include <vector>
+#include "scheduler.h"
+
+// Called on a scheduler thread for each job.
+typedef void (*GNBatchRunFn)(void *job);
+// Called on the main thread to describe a finished job to JavaScript.
+typedef v8::Local<v8::Value> (*GNBatchResultFn)(void *job);
+typedef void (*GNBatchDestroyFn)(void *job);
+
+// Runs every job on the scheduler's threads, at most concurrency at a time,
+// so that bulk work shares the scheduler's thread cap instead of starting
+// threads of its own. Interactive batches are held to one thread less than
+// the scheduler has, so that they cannot starve other interactive work. Finished jobs are handed to result_cb as an array
+// once batch_size of them have piled up, and at the end; then done_cb is
+// called with null. Takes ownership of the jobs and both callbacks. Main
+// thread only.
+void batch_run(const std::vector<void *> &jobs, int concurrency, int batch_size,
+        GNPriority priority, GNBatchRunFn run, GNBatchResultFn result,
+        GNBatchDestroyFn destroy, Nan::Callback *result_cb, Nan::Callback *done_cb);
+
+// Reads options.concurrency, throwing if it is less than 1.
+bool batch_get_concurrency(v8::Local<v8::Object> options, int *concurrency);
+
+#endif
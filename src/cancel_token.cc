@@ -0,0 +1,118 @@
+#include <node.h>
+#include "cancel_token.h"
+#include "env.h"
+
+using namespace v8;
+
+void cancel_state_ref(GNCancelState *state) {
+    if (state)
+        state->ref_count += 1;
+}
+
+void cancel_state_unref(GNCancelState *state) {
+    if (state && --state->ref_count == 0)
+        delete state;
+}
+
+bool cancel_state_is_cancelled(GNCancelState *state) {
+    return state && state->cancelled;
+}
+
+GNCancelToken::GNCancelToken() {
+    state = new GNCancelState;
+    state->cancelled = false;
+    state->ref_count = 1;
+};
+GNCancelToken::~GNCancelToken() {
+    cancel_state_unref(state);
+};
+
+static GNEnvPersistent<v8::Function> constructor;
+static GNEnvPersistent<v8::FunctionTemplate> constructor_template;
+
+void GNCancelToken::Init() {
+    // Prepare constructor template
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(Nan::New<String>("GrooveCancelToken").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+    Local<ObjectTemplate> proto = tpl->PrototypeTemplate();
+
+    // Fields
+    Nan::SetAccessor(proto, Nan::New<String>("cancelled").ToLocalChecked(), GetCancelled);
+
+    // Methods
+    Nan::SetPrototypeMethod(tpl, "cancel", Cancel);
+
+    constructor_template.Reset(tpl);
+    constructor.Reset(tpl->GetFunction());
+}
+
+NAN_METHOD(GNCancelToken::New) {
+    Nan::HandleScope scope;
+    assert(info.IsConstructCall());
+
+    GNCancelToken *obj = new GNCancelToken();
+    obj->Wrap(info.This());
+
+    info.GetReturnValue().Set(info.This());
+}
+
+Local<Value> GNCancelToken::NewInstance() {
+    Nan::EscapableHandleScope scope;
+
+    Local<Function> cons = constructor.Get();
+    Local<Object> instance = cons->NewInstance();
+
+    return scope.Escape(instance);
+}
+
+NAN_METHOD(GNCancelToken::Create) {
+    Nan::HandleScope scope;
+    info.GetReturnValue().Set(NewInstance());
+}
+
+bool GNCancelToken::FromOptions(Local<Object> options, GNCancelState **state) {
+    *state = NULL;
+    Local<Value> tokenValue = options->Get(Nan::New<String>("cancelToken").ToLocalChecked());
+    if (tokenValue->IsNull() || tokenValue->IsUndefined())
+        return true;
+    if (!constructor_template.Get()->HasInstance(tokenValue)) {
+        Nan::ThrowTypeError("Expected cancelToken to be from groove.createCancelToken()");
+        return false;
+    }
+    GNCancelToken *gn_token = node::ObjectWrap::Unwrap<GNCancelToken>(tokenValue->ToObject());
+    cancel_state_ref(gn_token->state);
+    *state = gn_token->state;
+    return true;
+}
+
+int GNCancelToken::ParseOptions(Nan::NAN_METHOD_ARGS_TYPE info, int options_index, GNCancelState **state) {
+    *state = NULL;
+    int cb_index = options_index;
+    if (info.Length() > options_index + 1) {
+        if (!info[options_index]->IsObject()) {
+            Nan::ThrowTypeError("Expected object options");
+            return -1;
+        }
+        if (!FromOptions(info[options_index]->ToObject(), state))
+            return -1;
+        cb_index = options_index + 1;
+    }
+    if (info.Length() <= cb_index || !info[cb_index]->IsFunction()) {
+        cancel_state_unref(*state);
+        *state = NULL;
+        Nan::ThrowTypeError("Expected function callback");
+        return -1;
+    }
+    return cb_index;
+}
+
+NAN_GETTER(GNCancelToken::GetCancelled) {
+    GNCancelToken *gn_token = node::ObjectWrap::Unwrap<GNCancelToken>(info.This());
+    info.GetReturnValue().Set(Nan::New<Boolean>(cancel_state_is_cancelled(gn_token->state)));
+}
+
+NAN_METHOD(GNCancelToken::Cancel) {
+    GNCancelToken *gn_token = node::ObjectWrap::Unwrap<GNCancelToken>(info.This());
+    gn_token->state->cancelled = true;
+}
@@ -0,0 +1,48 @@
+#ifndef GN_CANCEL_TOKEN_H
+#define GN_CANCEL_TOKEN_H
+
+#include <node.h>
+#include <nan.h>
+#include <atomic>
+
+// Shared between a GNCancelToken and every operation it was passed to.
+struct GNCancelState {
+    std::atomic<bool> cancelled;
+    std::atomic<int> ref_count;
+};
+
+// These accept NULL, meaning an operation that cannot be cancelled.
+void cancel_state_ref(GNCancelState *state);
+void cancel_state_unref(GNCancelState *state);
+bool cancel_state_is_cancelled(GNCancelState *state);
+
+class GNCancelToken : public node::ObjectWrap {
+    public:
+        static void Init();
+        static v8::Local<v8::Value> NewInstance();
+
+        static NAN_METHOD(Create);
+
+        // Reads options.cancelToken. On success *state is NULL or a new
+        // reference which the caller must unref. Returns false after
+        // throwing if cancelToken is not a token.
+        static bool FromOptions(v8::Local<v8::Object> options, GNCancelState **state);
+        // For methods shaped like fn(arg, [options], callback) where options
+        // is at options_index: checks the arguments and reads
+        // options.cancelToken. Returns the index of the callback, or -1
+        // after throwing.
+        static int ParseOptions(Nan::NAN_METHOD_ARGS_TYPE info, int options_index, GNCancelState **state);
+
+        GNCancelState *state;
+    private:
+        GNCancelToken();
+        ~GNCancelToken();
+
+        static NAN_METHOD(New);
+
+        static NAN_GETTER(GetCancelled);
+
+        static NAN_METHOD(Cancel);
+};
+
+#endif
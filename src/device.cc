@@ -1,4 +1,5 @@
 #include "device.h"
+#include "env.h"
 #include "file.h"
 
 using namespace v8;
@@ -8,7 +9,7 @@ GNDevice::~GNDevice() {
     soundio_device_unref(device);
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
 
 void GNDevice::Init() {
     // Prepare constructor template
@@ -25,6 +26,15 @@ void GNDevice::Init() {
     Nan::SetAccessor(proto, Nan::New<String>("softwareLatencyCurrent").ToLocalChecked(), GetSoftwareLatencyCurrent);
     Nan::SetAccessor(proto, Nan::New<String>("isRaw").ToLocalChecked(), GetIsRaw);
     Nan::SetAccessor(proto, Nan::New<String>("probeError").ToLocalChecked(), GetProbeError);
+    Nan::SetAccessor(proto, Nan::New<String>("formats").ToLocalChecked(), GetFormats);
+    Nan::SetAccessor(proto, Nan::New<String>("currentFormat").ToLocalChecked(), GetCurrentFormat);
+    Nan::SetAccessor(proto, Nan::New<String>("sampleRates").ToLocalChecked(), GetSampleRates);
+    Nan::SetAccessor(proto, Nan::New<String>("sampleRateCurrent").ToLocalChecked(), GetSampleRateCurrent);
+    Nan::SetAccessor(proto, Nan::New<String>("layouts").ToLocalChecked(), GetLayouts);
+    Nan::SetAccessor(proto, Nan::New<String>("currentLayout").ToLocalChecked(), GetCurrentLayout);
+
+    // Methods
+    Nan::SetPrototypeMethod(tpl, "supportsAudioFormat", SupportsAudioFormat);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -41,7 +51,7 @@ NAN_METHOD(GNDevice::New) {
 Local<Value> GNDevice::NewInstance(SoundIoDevice *device) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(instance);
@@ -91,3 +101,105 @@ NAN_GETTER(GNDevice::GetProbeError) {
     SoundIoDevice *device = gn_device->device;
     info.GetReturnValue().Set(Nan::New<Number>(device->probe_error));
 }
+
+Local<Array> GNDevice::NewLayoutArray(const SoundIoChannelLayout *layout) {
+    Nan::EscapableHandleScope scope;
+    Local<Array> array = Nan::New<Array>();
+    for (int ch = 0; ch < layout->channel_count; ch += 1)
+        Nan::Set(array, Nan::New<Number>(ch), Nan::New<Number>(layout->channels[ch]));
+    return scope.Escape(array);
+}
+
+Local<Object> GNDevice::NewAudioFormatObject(const GrooveAudioFormat *format) {
+    Nan::EscapableHandleScope scope;
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New<String>("sampleRate").ToLocalChecked(), Nan::New<Number>(format->sample_rate));
+    Nan::Set(object, Nan::New<String>("channelLayout").ToLocalChecked(), NewLayoutArray(&format->layout));
+    Nan::Set(object, Nan::New<String>("sampleFormat").ToLocalChecked(), Nan::New<Number>(format->format));
+    return scope.Escape(object);
+}
+
+NAN_GETTER(GNDevice::GetFormats) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    Local<Array> formats = Nan::New<Array>();
+    for (int i = 0; i < device->format_count; i += 1)
+        Nan::Set(formats, Nan::New<Number>(i), Nan::New<Number>(device->formats[i]));
+    info.GetReturnValue().Set(formats);
+}
+
+NAN_GETTER(GNDevice::GetCurrentFormat) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    info.GetReturnValue().Set(Nan::New<Number>(device->current_format));
+}
+
+NAN_GETTER(GNDevice::GetSampleRates) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    Local<Array> ranges = Nan::New<Array>();
+    for (int i = 0; i < device->sample_rate_count; i += 1) {
+        Local<Object> range = Nan::New<Object>();
+        Nan::Set(range, Nan::New<String>("min").ToLocalChecked(), Nan::New<Number>(device->sample_rates[i].min));
+        Nan::Set(range, Nan::New<String>("max").ToLocalChecked(), Nan::New<Number>(device->sample_rates[i].max));
+        Nan::Set(ranges, Nan::New<Number>(i), range);
+    }
+    info.GetReturnValue().Set(ranges);
+}
+
+NAN_GETTER(GNDevice::GetSampleRateCurrent) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    info.GetReturnValue().Set(Nan::New<Number>(device->sample_rate_current));
+}
+
+NAN_GETTER(GNDevice::GetLayouts) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    Local<Array> layouts = Nan::New<Array>();
+    for (int i = 0; i < device->layout_count; i += 1)
+        Nan::Set(layouts, Nan::New<Number>(i), NewLayoutArray(&device->layouts[i]));
+    info.GetReturnValue().Set(layouts);
+}
+
+NAN_GETTER(GNDevice::GetCurrentLayout) {
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    info.GetReturnValue().Set(NewLayoutArray(&device->current_layout));
+}
+
+NAN_METHOD(GNDevice::SupportsAudioFormat) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    Local<Object> format = info[0]->ToObject();
+    Local<Value> layout_value = Nan::Get(format, Nan::New<String>("channelLayout").ToLocalChecked()).ToLocalChecked();
+    if (!layout_value->IsArray()) {
+        Nan::ThrowTypeError("Expected channelLayout to be an array");
+        return;
+    }
+    Local<Array> layout_array = layout_value.As<Array>();
+    if (layout_array->Length() > SOUNDIO_MAX_CHANNELS) {
+        info.GetReturnValue().Set(Nan::False());
+        return;
+    }
+    SoundIoChannelLayout layout;
+    layout.name = NULL;
+    layout.channel_count = layout_array->Length();
+    for (int ch = 0; ch < layout.channel_count; ch += 1)
+        layout.channels[ch] = (SoundIoChannelId)(int)Nan::Get(layout_array, ch).ToLocalChecked()->NumberValue();
+
+    int sample_rate = (int)Nan::Get(format, Nan::New<String>("sampleRate").ToLocalChecked()).ToLocalChecked()->NumberValue();
+    SoundIoFormat sample_format = (SoundIoFormat)(int)Nan::Get(format,
+            Nan::New<String>("sampleFormat").ToLocalChecked()).ToLocalChecked()->NumberValue();
+
+    GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(info.This());
+    SoundIoDevice *device = gn_device->device;
+    bool supported = soundio_device_supports_format(device, sample_format) &&
+        soundio_device_supports_sample_rate(device, sample_rate) &&
+        soundio_device_supports_layout(device, &layout);
+    info.GetReturnValue().Set(Nan::New<Boolean>(supported));
+}
@@ -10,6 +10,10 @@ class GNDevice : public node::ObjectWrap {
         static void Init();
         static v8::Local<v8::Value> NewInstance(SoundIoDevice *device);
 
+        // an array of channel ids, as in audio format objects
+        static v8::Local<v8::Array> NewLayoutArray(const SoundIoChannelLayout *layout);
+        static v8::Local<v8::Object> NewAudioFormatObject(const GrooveAudioFormat *format);
+
         SoundIoDevice *device;
     private:
         GNDevice();
@@ -24,6 +28,14 @@ class GNDevice : public node::ObjectWrap {
         static NAN_GETTER(GetSoftwareLatencyCurrent);
         static NAN_GETTER(GetIsRaw);
         static NAN_GETTER(GetProbeError);
+        static NAN_GETTER(GetFormats);
+        static NAN_GETTER(GetCurrentFormat);
+        static NAN_GETTER(GetSampleRates);
+        static NAN_GETTER(GetSampleRateCurrent);
+        static NAN_GETTER(GetLayouts);
+        static NAN_GETTER(GetCurrentLayout);
+
+        static NAN_METHOD(SupportsAudioFormat);
 };
 
 #endif
@@ -0,0 +1,179 @@
+#include <algorithm>
+#include "device_watcher.h"
+
+static uv_once_t watcher_once = UV_ONCE_INIT;
+static uv_mutex_t watcher_mutex;
+static uv_cond_t watcher_cond;
+static uv_thread_t watcher_thread;
+
+// how often device_watcher_stop repeats its wakeup
+static const uint64_t wakeup_retry_ns = 1000000;
+
+// guarded by watcher_mutex
+static SoundIo *watched = NULL;
+static bool running = false;
+static bool stop_requested = false;
+static bool thread_exited = false;
+static bool have_snapshot = false;
+static uint32_t version = 0;
+static std::vector<SoundIoDevice *> snapshot;
+static int snapshot_default_index = -1;
+static std::vector<uv_async_t *> listeners;
+
+// only touched by the watcher thread
+static bool devices_changed = false;
+
+static void init_watcher_mutex(void) {
+    uv_mutex_init(&watcher_mutex);
+    uv_cond_init(&watcher_cond);
+}
+
+// call with watcher_mutex held
+static void clear_snapshot(void) {
+    for (size_t i = 0; i < snapshot.size(); i += 1)
+        soundio_device_unref(snapshot[i]);
+    snapshot.clear();
+    snapshot_default_index = -1;
+}
+
+// call with watcher_mutex held
+static void bump_version(void) {
+    version += 1;
+    for (size_t i = 0; i < listeners.size(); i += 1)
+        uv_async_send(listeners[i]);
+}
+
+static void OnDevicesChange(SoundIo *soundio) {
+    devices_changed = true;
+}
+
+// Reads the device list from the watcher thread, which is the only one to
+// flush events and so the only one which may read the list.
+static void take_snapshot(SoundIo *soundio) {
+    std::vector<SoundIoDevice *> devices;
+    int count = soundio_output_device_count(soundio);
+    for (int i = 0; i < count; i += 1)
+        devices.push_back(soundio_get_output_device(soundio, i));
+    int default_index = soundio_default_output_device_index(soundio);
+
+    uv_mutex_lock(&watcher_mutex);
+    clear_snapshot();
+    snapshot.swap(devices);
+    snapshot_default_index = default_index;
+    have_snapshot = true;
+    bump_version();
+    uv_cond_signal(&watcher_cond);
+    uv_mutex_unlock(&watcher_mutex);
+}
+
+static void WatcherThreadEntry(void *arg) {
+    SoundIo *soundio = reinterpret_cast<SoundIo *>(arg);
+
+    soundio_flush_events(soundio);
+    take_snapshot(soundio);
+    devices_changed = false;
+
+    for (;;) {
+        uv_mutex_lock(&watcher_mutex);
+        bool stop = stop_requested;
+        uv_mutex_unlock(&watcher_mutex);
+        if (stop)
+            break;
+
+        // A wakeup sent between the check above and this wait can be lost,
+        // so device_watcher_stop keeps sending them until we have exited.
+        soundio_wait_events(soundio);
+
+        if (devices_changed) {
+            devices_changed = false;
+            take_snapshot(soundio);
+        }
+    }
+
+    uv_mutex_lock(&watcher_mutex);
+    thread_exited = true;
+    uv_cond_signal(&watcher_cond);
+    uv_mutex_unlock(&watcher_mutex);
+}
+
+void device_watcher_start(SoundIo *soundio) {
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    watched = soundio;
+    stop_requested = false;
+    thread_exited = false;
+    have_snapshot = false;
+    soundio->on_devices_change = OnDevicesChange;
+    running = true;
+    uv_thread_create(&watcher_thread, WatcherThreadEntry, soundio);
+    // getDevices() right after connecting should see the devices
+    while (!have_snapshot)
+        uv_cond_wait(&watcher_cond, &watcher_mutex);
+    uv_mutex_unlock(&watcher_mutex);
+}
+
+void device_watcher_stop(void) {
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    if (!running) {
+        uv_mutex_unlock(&watcher_mutex);
+        return;
+    }
+    stop_requested = true;
+    while (!thread_exited) {
+        soundio_wakeup(watched);
+        uv_cond_timedwait(&watcher_cond, &watcher_mutex, wakeup_retry_ns);
+    }
+    uv_mutex_unlock(&watcher_mutex);
+
+    uv_thread_join(&watcher_thread);
+
+    uv_mutex_lock(&watcher_mutex);
+    running = false;
+    have_snapshot = false;
+    watched = NULL;
+    clear_snapshot();
+    bump_version();
+    uv_mutex_unlock(&watcher_mutex);
+}
+
+uint32_t device_watcher_version(void) {
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    uint32_t result = version;
+    uv_mutex_unlock(&watcher_mutex);
+    return result;
+}
+
+bool device_watcher_snapshot(std::vector<SoundIoDevice *> *devices, int *default_index,
+        uint32_t *out_version)
+{
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    bool ok = have_snapshot;
+    if (ok) {
+        *devices = snapshot;
+        for (size_t i = 0; i < devices->size(); i += 1)
+            soundio_device_ref((*devices)[i]);
+        *default_index = snapshot_default_index;
+    }
+    *out_version = version;
+    uv_mutex_unlock(&watcher_mutex);
+    return ok;
+}
+
+void device_watcher_listen(uv_async_t *async) {
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    listeners.push_back(async);
+    uv_mutex_unlock(&watcher_mutex);
+}
+
+void device_watcher_unlisten(uv_async_t *async) {
+    uv_once(&watcher_once, init_watcher_mutex);
+    uv_mutex_lock(&watcher_mutex);
+    std::vector<uv_async_t *>::iterator it = std::find(listeners.begin(), listeners.end(), async);
+    if (it != listeners.end())
+        listeners.erase(it);
+    uv_mutex_unlock(&watcher_mutex);
+}
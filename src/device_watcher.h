@@ -0,0 +1,32 @@
+#ifndef GN_DEVICE_WATCHER_H
+#define GN_DEVICE_WATCHER_H
+
+#include <uv.h>
+#include <stdint.h>
+#include <vector>
+#include <groove/groove.h>
+
+// While a backend is connected, one thread waits on soundio_wait_events and
+// keeps a snapshot of the output devices, so that reading the device list
+// never has to call into libsoundio.
+
+// Call right after connecting a backend and before disconnecting it. These
+// do not serialize with each other; the caller does that.
+void device_watcher_start(SoundIo *soundio);
+void device_watcher_stop(void);
+
+// Increases whenever the snapshot changes, including when the watcher
+// starts and stops. Cheap enough to call on every getDevices().
+uint32_t device_watcher_version(void);
+
+// Copies the snapshot, adding a reference to each device which the caller
+// must drop. Returns false if no backend is connected.
+bool device_watcher_snapshot(std::vector<SoundIoDevice *> *devices, int *default_index,
+        uint32_t *version);
+
+// async is sent every time the version changes. May be called from any
+// thread.
+void device_watcher_listen(uv_async_t *async);
+void device_watcher_unlisten(uv_async_t *async);
+
+#endif
@@ -1,19 +1,31 @@
 #include <node_buffer.h>
 #include "encoder.h"
+#include "env.h"
 #include "playlist.h"
 #include "playlist_item.h"
 #include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
 
 using namespace v8;
 
 GNEncoder::GNEncoder() {};
 GNEncoder::~GNEncoder() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    position_view_destroy(event_context->position_view);
     groove_encoder_destroy(encoder);
+    uv_mutex_destroy(&event_context->mutex);
     delete event_context->event_cb;
     delete event_context;
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *sink, GroovePlaylistItem **item, double *pos) {
+    groove_encoder_position(reinterpret_cast<GrooveEncoder *>(sink), item, pos);
+}
 
 void GNEncoder::Init() {
     // Prepare constructor template
@@ -30,6 +42,7 @@ void GNEncoder::Init() {
     Nan::SetPrototypeMethod(tpl, "detach", Detach);
     Nan::SetPrototypeMethod(tpl, "getBuffer", GetBuffer);
     Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -71,7 +84,7 @@ NAN_GETTER(GNEncoder::GetActualAudioFormat) {
 Local<Value> GNEncoder::NewInstance(GrooveEncoder *encoder) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNEncoder *gn_encoder = node::ObjectWrap::Unwrap<GNEncoder>(instance);
@@ -80,10 +93,22 @@ Local<Value> GNEncoder::NewInstance(GrooveEncoder *encoder) {
     return scope.Escape(instance);
 }
 
-static void EncoderEventAsyncCb(uv_async_t *handle) {
+static bool EncoderEventPoll(void *arg) {
+    GNEncoder::EventContext *context = reinterpret_cast<GNEncoder::EventContext *>(arg);
+    bool emit = false;
+    uv_mutex_lock(&context->mutex);
+    if (context->emit_buffer_ok && groove_encoder_buffer_peek(context->encoder, 0) > 0) {
+        context->emit_buffer_ok = false;
+        emit = true;
+    }
+    uv_mutex_unlock(&context->mutex);
+    return emit;
+}
+
+static void EncoderEventFlush(void *arg) {
     Nan::HandleScope scope;
 
-    GNEncoder::EventContext *context = reinterpret_cast<GNEncoder::EventContext *>(handle->data);
+    GNEncoder::EventContext *context = reinterpret_cast<GNEncoder::EventContext *>(arg);
 
     const unsigned argc = 1;
     Local<Value> argv[argc];
@@ -95,23 +120,6 @@ static void EncoderEventAsyncCb(uv_async_t *handle) {
     if (try_catch.HasCaught()) {
         node::FatalException(try_catch);
     }
-
-    uv_mutex_lock(&context->mutex);
-    uv_cond_signal(&context->cond);
-    uv_mutex_unlock(&context->mutex);
-}
-
-static void EncoderEventThreadEntry(void *arg) {
-    GNEncoder::EventContext *context = reinterpret_cast<GNEncoder::EventContext *>(arg);
-    while (groove_encoder_buffer_peek(context->encoder, 1) > 0) {
-        uv_mutex_lock(&context->mutex);
-        if (context->emit_buffer_ok) {
-            context->emit_buffer_ok = false;
-            uv_async_send(&context->event_async);
-        }
-        uv_cond_wait(&context->cond, &context->mutex);
-        uv_mutex_unlock(&context->mutex);
-    }
 }
 
 class EncoderAttachWorker : public Nan::AsyncWorker {
@@ -121,7 +129,7 @@ public:
             String::Utf8Value *format_short_name,
             String::Utf8Value *codec_short_name,
             String::Utf8Value *filename,
-            String::Utf8Value *mime_type) :
+            String::Utf8Value *mime_type, GNCancelState *cancel) :
         Nan::AsyncWorker(callback)
     {
         this->encoder = encoder;
@@ -131,8 +139,10 @@ public:
         this->codec_short_name = codec_short_name;
         this->filename = filename;
         this->mime_type = mime_type;
+        this->cancel = cancel;
     }
     ~EncoderAttachWorker() {
+        cancel_state_unref(cancel);
         delete format_short_name;
         delete codec_short_name;
         delete filename;
@@ -140,6 +150,10 @@ public:
     }
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         encoder->format_short_name = format_short_name ? **format_short_name : NULL;
         encoder->codec_short_name = codec_short_name ? **codec_short_name : NULL;
         encoder->filename = filename ? **filename : NULL;
@@ -151,13 +165,13 @@ public:
             return;
         }
 
-        uv_cond_init(&event_context->cond);
-        uv_mutex_init(&event_context->mutex);
-
-        event_context->event_async.data = event_context;
-        uv_async_init(uv_default_loop(), &event_context->event_async, EncoderEventAsyncCb);
+        position_view_attach(event_context->position_view, playlist);
+    }
 
-        uv_thread_create(&event_context->event_thread, EncoderEventThreadEntry, event_context);
+    void HandleOKCallback() {
+        event_context->event_source = event_dispatcher_add(EncoderEventPoll,
+                EncoderEventFlush, event_context);
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GrooveEncoder *encoder;
@@ -167,6 +181,7 @@ public:
     String::Utf8Value *codec_short_name;
     String::Utf8Value *filename;
     String::Utf8Value *mime_type;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNEncoder::Create) {
@@ -183,8 +198,11 @@ NAN_METHOD(GNEncoder::Create) {
     EventContext *context = new EventContext;
     gn_encoder->event_context = context;
     context->emit_buffer_ok = true;
+    context->event_source = NULL;
+    uv_mutex_init(&context->mutex);
     context->event_cb = new Nan::Callback(info[0].As<Function>());
     context->encoder = encoder;
+    context->position_view = position_view_create(encoder, PositionFn);
 
     // set properties on the instance with default values from
     // GrooveEncoder struct
@@ -223,12 +241,6 @@ NAN_METHOD(GNEncoder::Attach) {
         Nan::ThrowTypeError("Expected object arg[0]");
         return;
     }
-    if (info.Length() < 2 || !info[1]->IsFunction()) {
-        Nan::ThrowTypeError("Expected function arg[1]");
-        return;
-    }
-    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
-
     Local<Object> instance = info.This();
     Local<Value> targetAudioFormatValue = instance->Get(Nan::New<String>("targetAudioFormat").ToLocalChecked());
     if (!targetAudioFormatValue->IsObject()) {
@@ -236,6 +248,13 @@ NAN_METHOD(GNEncoder::Attach) {
         return;
     }
 
+    // nothing below throws, so the token and the callback cannot leak
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
+        return;
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info[0]->ToObject());
     GrooveEncoder *encoder = gn_encoder->encoder;
 
@@ -295,8 +314,8 @@ NAN_METHOD(GNEncoder::Attach) {
     double encoded_buffer_size = instance->Get(Nan::New<String>("encodedBufferSize").ToLocalChecked())->NumberValue();
     encoder->encoded_buffer_size = (int)encoded_buffer_size;
 
-    AsyncQueueWorker(new EncoderAttachWorker(callback, encoder, gn_playlist->playlist, gn_encoder->event_context,
-                format_short_name, codec_short_name, filename, mime_type));
+    scheduler_queue(new EncoderAttachWorker(callback, encoder, gn_playlist->playlist, gn_encoder->event_context,
+                format_short_name, codec_short_name, filename, mime_type, cancel), GNPriorityInteractive);
 }
 
 class EncoderDetachWorker : public Nan::AsyncWorker {
@@ -312,16 +331,12 @@ public:
 
     void Execute() {
         int err;
+        position_view_detach(event_context->position_view);
         if ((err = groove_encoder_detach(encoder))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
 
-        uv_cond_signal(&event_context->cond);
-        uv_thread_join(&event_context->event_thread);
-        uv_cond_destroy(&event_context->cond);
-        uv_mutex_destroy(&event_context->mutex);
-        uv_close(reinterpret_cast<uv_handle_t*>(&event_context->event_async), NULL);
     }
 
     GrooveEncoder *encoder;
@@ -345,7 +360,13 @@ NAN_METHOD(GNEncoder::Detach) {
         return;
     }
 
-    AsyncQueueWorker(new EncoderDetachWorker(callback, encoder, gn_encoder->event_context));
+    // stop delivering events now rather than when the detach finishes
+    if (gn_encoder->event_context->event_source) {
+        event_dispatcher_remove(gn_encoder->event_context->event_source);
+        gn_encoder->event_context->event_source = NULL;
+    }
+
+    scheduler_queue(new EncoderDetachWorker(callback, encoder, gn_encoder->event_context), GNPriorityInteractive);
 }
 
 static void encoder_buffer_free(char *data, void *hint) {
@@ -363,8 +384,8 @@ NAN_METHOD(GNEncoder::GetBuffer) {
 
     uv_mutex_lock(&gn_encoder->event_context->mutex);
     gn_encoder->event_context->emit_buffer_ok = true;
-    uv_cond_signal(&gn_encoder->event_context->cond);
     uv_mutex_unlock(&gn_encoder->event_context->mutex);
+    event_dispatcher_wake();
 
     switch (buf_result) {
         case GROOVE_BUFFER_YES: {
@@ -424,3 +445,9 @@ NAN_METHOD(GNEncoder::Position) {
 
     info.GetReturnValue().Set(obj);
 }
+
+NAN_METHOD(GNEncoder::PositionView) {
+    Nan::HandleScope scope;
+    GNEncoder *gn_encoder = node::ObjectWrap::Unwrap<GNEncoder>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_encoder->event_context->position_view));
+}
@@ -4,6 +4,8 @@
 #include <node.h>
 #include <nan.h>
 #include <groove/encoder.h>
+#include "position_view.h"
+#include "event_dispatcher.h"
 
 class GNEncoder : public node::ObjectWrap {
     public:
@@ -13,12 +15,11 @@ class GNEncoder : public node::ObjectWrap {
         static NAN_METHOD(Create);
 
         struct EventContext {
-            uv_thread_t event_thread;
-            uv_async_t event_async;
-            uv_cond_t cond;
+            GNEventSource *event_source;
             uv_mutex_t mutex;
             GrooveEncoder *encoder;
             Nan::Callback *event_cb;
+            GNPositionView *position_view;
             bool emit_buffer_ok;
         };
 
@@ -36,6 +37,7 @@ class GNEncoder : public node::ObjectWrap {
         static NAN_METHOD(Detach);
         static NAN_METHOD(GetBuffer);
         static NAN_METHOD(Position);
+        static NAN_METHOD(PositionView);
 };
 
 #endif
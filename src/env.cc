@@ -0,0 +1,64 @@
+#include <unordered_map>
+#include <vector>
+#include "env.h"
+
+using namespace v8;
+
+struct GNEnv {
+    uv_loop_t *loop;
+    std::unordered_map<const void *, Nan::Persistent<Value> *> handles;
+    std::vector<std::pair<void (*)(void *), void *> > exit_fns;
+};
+
+static thread_local GNEnv *current_env = NULL;
+
+static void cleanup_env(void *arg) {
+    GNEnv *env = reinterpret_cast<GNEnv *>(arg);
+    while (!env->exit_fns.empty()) {
+        std::pair<void (*)(void *), void *> exit_fn = env->exit_fns.back();
+        env->exit_fns.pop_back();
+        exit_fn.first(exit_fn.second);
+    }
+    std::unordered_map<const void *, Nan::Persistent<Value> *>::iterator it;
+    for (it = env->handles.begin(); it != env->handles.end(); ++it) {
+        it->second->Reset();
+        delete it->second;
+    }
+    if (current_env == env)
+        current_env = NULL;
+    delete env;
+}
+
+static GNEnv *get_env() {
+    if (current_env)
+        return current_env;
+    GNEnv *env = new GNEnv;
+    env->loop = Nan::GetCurrentEventLoop();
+    // before this there are no worker threads, and nothing to clean up
+    // until the process exits
+#if NODE_MAJOR_VERSION > 10 || (NODE_MAJOR_VERSION == 10 && NODE_MINOR_VERSION >= 2)
+    node::AddEnvironmentCleanupHook(Isolate::GetCurrent(), cleanup_env, env);
+#endif
+    current_env = env;
+    return env;
+}
+
+uv_loop_t *env_loop() {
+    return get_env()->loop;
+}
+
+void env_at_exit(void (*fn)(void *arg), void *arg) {
+    get_env()->exit_fns.push_back(std::make_pair(fn, arg));
+}
+
+void env_persistent_reset(const void *key, Local<Value> value) {
+    GNEnv *env = get_env();
+    Nan::Persistent<Value> *&handle = env->handles[key];
+    if (!handle)
+        handle = new Nan::Persistent<Value>();
+    handle->Reset(value);
+}
+
+Local<Value> env_persistent_get(const void *key) {
+    return Nan::New(*get_env()->handles[key]);
+}
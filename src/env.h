@@ -0,0 +1,37 @@
+#ifndef GN_ENV_H
+#define GN_ENV_H
+
+#include <node.h>
+#include <nan.h>
+#include <uv.h>
+
+// The module may be loaded by the main thread and by worker threads at the
+// same time. Each of them is an environment with its own isolate and loop,
+// and runs JavaScript on a thread of its own, so state which belongs to an
+// environment is either kept here or declared thread_local.
+
+// The loop of the calling thread's environment.
+uv_loop_t *env_loop();
+
+// Runs fn(arg) when the calling thread's environment shuts down, while its
+// isolate can still be used. Functions run in the reverse order they were
+// added.
+void env_at_exit(void (*fn)(void *arg), void *arg);
+
+void env_persistent_reset(const void *key, v8::Local<v8::Value> value);
+v8::Local<v8::Value> env_persistent_get(const void *key);
+
+// A persistent handle with a separate value in each environment, since
+// handles cannot be shared between isolates. Used for constructors.
+template <typename T>
+class GNEnvPersistent {
+    public:
+        void Reset(v8::Local<T> value) {
+            env_persistent_reset(this, value);
+        }
+        v8::Local<T> Get() {
+            return env_persistent_get(this).template As<T>();
+        }
+};
+
+#endif
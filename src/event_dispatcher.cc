@@ -0,0 +1,196 @@
+#include <uv.h>
+#include <algorithm>
+#include <vector>
+#include "event_dispatcher.h"
+#include "env.h"
+
+// The poll interval starts at min_wait_ns and doubles up to max_wait_ns while
+// nothing is found. Finishing a flush always triggers an immediate poll, so
+// a sink which is being drained as fast as it fills never waits.
+static const uint64_t min_wait_ns = 1000000;
+static const uint64_t max_wait_ns = 10000000;
+
+// Ready sources are flushed on the loop of the environment which added them,
+// through one of these per environment.
+struct Dispatch {
+    uv_async_t flush_async;
+    // guarded by mutex
+    std::vector<GNEventSource *> ready;
+    // only touched from the environment's thread
+    size_t source_count;
+    bool flushing;
+    std::vector<GNEventSource *> removed_while_flushing;
+};
+
+struct GNEventSource {
+    GNEventPollFn poll;
+    GNEventFlushFn flush;
+    void *arg;
+    Dispatch *dispatch;
+    // waiting in ready or being flushed
+    bool pending;
+    // removed while its batch was being flushed
+    bool removed;
+};
+
+static uv_once_t init_once = UV_ONCE_INIT;
+static uv_thread_t thread;
+
+static uv_mutex_t mutex;
+static uv_cond_t cond;
+static std::vector<GNEventSource *> sources;
+static bool poll_now = false;
+
+static thread_local Dispatch *env_dispatch = NULL;
+
+static void ThreadEntry(void *arg) {
+    uint64_t wait_ns = min_wait_ns;
+    std::vector<Dispatch *> wake;
+    uv_mutex_lock(&mutex);
+    for (;;) {
+        for (size_t i = 0; i < sources.size(); i += 1) {
+            GNEventSource *source = sources[i];
+            if (source->pending || !source->poll(source->arg))
+                continue;
+            source->pending = true;
+            source->dispatch->ready.push_back(source);
+            if (std::find(wake.begin(), wake.end(), source->dispatch) == wake.end())
+                wake.push_back(source->dispatch);
+        }
+        bool found = !wake.empty();
+        for (size_t i = 0; i < wake.size(); i += 1)
+            uv_async_send(&wake[i]->flush_async);
+        wake.clear();
+
+        if (sources.empty()) {
+            uv_cond_wait(&cond, &mutex);
+            wait_ns = min_wait_ns;
+        } else if (!poll_now) {
+            wait_ns = found ? min_wait_ns : std::min(wait_ns * 2, max_wait_ns);
+            uv_cond_timedwait(&cond, &mutex, wait_ns);
+        }
+        if (poll_now)
+            wait_ns = min_wait_ns;
+        poll_now = false;
+    }
+}
+
+static void FlushAsyncCb(uv_async_t *handle) {
+    Dispatch *dispatch = reinterpret_cast<Dispatch *>(handle->data);
+    std::vector<GNEventSource *> batch;
+    uv_mutex_lock(&mutex);
+    batch.swap(dispatch->ready);
+    uv_mutex_unlock(&mutex);
+
+    dispatch->flushing = true;
+    for (size_t i = 0; i < batch.size(); i += 1) {
+        if (!batch[i]->removed)
+            batch[i]->flush(batch[i]->arg);
+    }
+    dispatch->flushing = false;
+
+    uv_mutex_lock(&mutex);
+    for (size_t i = 0; i < batch.size(); i += 1)
+        batch[i]->pending = false;
+    poll_now = true;
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+
+    for (size_t i = 0; i < dispatch->removed_while_flushing.size(); i += 1)
+        delete dispatch->removed_while_flushing[i];
+    dispatch->removed_while_flushing.clear();
+}
+
+static void close_dispatch(void *arg) {
+    Dispatch *dispatch = reinterpret_cast<Dispatch *>(arg);
+    // Stop polling the environment's sinks. The sources themselves, and
+    // this struct which they point to, are left for any sink destructors
+    // which still run.
+    uv_mutex_lock(&mutex);
+    std::vector<GNEventSource *> kept;
+    for (size_t i = 0; i < sources.size(); i += 1) {
+        if (sources[i]->dispatch != dispatch)
+            kept.push_back(sources[i]);
+    }
+    sources.swap(kept);
+    dispatch->ready.clear();
+    uv_mutex_unlock(&mutex);
+
+    env_dispatch = NULL;
+    uv_close(reinterpret_cast<uv_handle_t*>(&dispatch->flush_async), NULL);
+}
+
+static void init_thread(void) {
+    uv_mutex_init(&mutex);
+    uv_cond_init(&cond);
+    uv_thread_create(&thread, ThreadEntry, NULL);
+}
+
+static Dispatch *get_dispatch(void) {
+    if (env_dispatch)
+        return env_dispatch;
+    Dispatch *dispatch = new Dispatch;
+    dispatch->source_count = 0;
+    dispatch->flushing = false;
+    dispatch->flush_async.data = dispatch;
+    uv_async_init(env_loop(), &dispatch->flush_async, FlushAsyncCb);
+    uv_unref(reinterpret_cast<uv_handle_t*>(&dispatch->flush_async));
+    env_at_exit(close_dispatch, dispatch);
+    env_dispatch = dispatch;
+    return dispatch;
+}
+
+GNEventSource *event_dispatcher_add(GNEventPollFn poll, GNEventFlushFn flush, void *arg) {
+    uv_once(&init_once, init_thread);
+    Dispatch *dispatch = get_dispatch();
+
+    GNEventSource *source = new GNEventSource;
+    source->poll = poll;
+    source->flush = flush;
+    source->arg = arg;
+    source->dispatch = dispatch;
+    source->pending = false;
+    source->removed = false;
+
+    uv_mutex_lock(&mutex);
+    sources.push_back(source);
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+
+    dispatch->source_count += 1;
+    if (dispatch->source_count == 1)
+        uv_ref(reinterpret_cast<uv_handle_t*>(&dispatch->flush_async));
+    return source;
+}
+
+void event_dispatcher_remove(GNEventSource *source) {
+    Dispatch *dispatch = source->dispatch;
+
+    uv_mutex_lock(&mutex);
+    std::vector<GNEventSource *>::iterator it = std::find(sources.begin(), sources.end(), source);
+    if (it != sources.end())
+        sources.erase(it);
+    it = std::find(dispatch->ready.begin(), dispatch->ready.end(), source);
+    if (it != dispatch->ready.end())
+        dispatch->ready.erase(it);
+    uv_mutex_unlock(&mutex);
+
+    dispatch->source_count -= 1;
+    if (dispatch->source_count == 0 && env_dispatch == dispatch)
+        uv_unref(reinterpret_cast<uv_handle_t*>(&dispatch->flush_async));
+
+    if (dispatch->flushing) {
+        source->removed = true;
+        dispatch->removed_while_flushing.push_back(source);
+    } else {
+        delete source;
+    }
+}
+
+void event_dispatcher_wake(void) {
+    uv_once(&init_once, init_thread);
+    uv_mutex_lock(&mutex);
+    poll_now = true;
+    uv_cond_signal(&cond);
+    uv_mutex_unlock(&mutex);
+}
@@ -0,0 +1,27 @@
+#ifndef GN_EVENT_DISPATCHER_H
+#define GN_EVENT_DISPATCHER_H
+
+// Called on the dispatcher thread to check a sink without blocking. Returns
+// true if flush should be called.
+typedef bool (*GNEventPollFn)(void *arg);
+// Called on the main thread after poll returned true. The source is not
+// polled again until flush has returned.
+typedef void (*GNEventFlushFn)(void *arg);
+
+struct GNEventSource;
+
+// One thread polls every attached sink and wakes the main loop once per
+// batch, so the thread count does not grow with the number of sinks. The
+// loop is kept alive while any source exists.
+//
+// Both of these must be called on the main thread. flush is never called
+// for a source after it has been removed.
+GNEventSource *event_dispatcher_add(GNEventPollFn poll, GNEventFlushFn flush, void *arg);
+void event_dispatcher_remove(GNEventSource *source);
+
+// Polls every source right away instead of waiting for the next interval.
+// For sinks whose poll depends on something other than libgroove, such as
+// the encoder waiting for its buffers to be read. Main thread only.
+void event_dispatcher_wake(void);
+
+#endif
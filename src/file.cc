@@ -1,13 +1,26 @@
 #include <node.h>
+#include <node_buffer.h>
+#include <ctype.h>
+#include <string>
+#include <vector>
 #include "file.h"
+#include "env.h"
+#include "device.h"
+#include "stream_writer.h"
+#include "tag_writer.h"
+#include "scheduler.h"
+#include "batch_runner.h"
+#include "cancel_token.h"
 #include "groove.h"
 
 using namespace v8;
 
-GNFile::GNFile() {};
-GNFile::~GNFile() {};
+GNFile::GNFile() : file(NULL), cached(NULL), io(NULL), pool(NULL), busy_count(0) {};
+GNFile::~GNFile() {
+    io_buffer.Reset();
+};
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
 
 void GNFile::Init() {
     // Prepare constructor template
@@ -29,7 +42,9 @@ void GNFile::Init() {
     Nan::SetPrototypeMethod(tpl, "shortNames", ShortNames);
     Nan::SetPrototypeMethod(tpl, "save", Save);
     Nan::SetPrototypeMethod(tpl, "duration", Duration);
+    Nan::SetPrototypeMethod(tpl, "audioFormat", AudioFormat);
     Nan::SetPrototypeMethod(tpl, "overrideDuration", OverrideDuration);
+    Nan::SetPrototypeMethod(tpl, "computeExactDuration", ComputeExactDuration);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -47,7 +62,7 @@ NAN_METHOD(GNFile::New) {
 Local<Value> GNFile::NewInstance(GrooveFile *file) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(instance);
@@ -56,9 +71,58 @@ Local<Value> GNFile::NewInstance(GrooveFile *file) {
     return scope.Escape(instance);
 }
 
+Local<Value> GNFile::NewCachedInstance(GNFileInfo *cached) {
+    Nan::EscapableHandleScope scope;
+
+    Local<Function> cons = constructor.Get();
+    Local<Object> instance = cons->NewInstance();
+
+    GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(instance);
+    gn_file->cached = cached;
+
+    return scope.Escape(instance);
+}
+
+static bool keys_equal(const std::string &a, const char *b, bool match_case) {
+    size_t i = 0;
+    for (; i < a.size() && b[i]; i += 1) {
+        if (match_case ? (a[i] != b[i]) : (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])))
+            return false;
+    }
+    return i == a.size() && !b[i];
+}
+
+static void read_file_info(GrooveFile *file, GNFileInfo *info) {
+    info->filename = file->filename;
+    info->duration = groove_file_duration(file);
+    info->short_names = groove_file_short_names(file);
+    info->tags.clear();
+    GrooveTag *tag = NULL;
+    while ((tag = groove_file_metadata_get(file, "", tag, 0))) {
+        info->tags.push_back(std::make_pair(std::string(groove_tag_key(tag)),
+                    std::string(groove_tag_value(tag))));
+    }
+}
+
+static bool require_open_file(GNFile *gn_file) {
+    if (gn_file->cached) {
+        Nan::ThrowError("file was opened with metadataOnly");
+        return false;
+    }
+    if (!gn_file->file) {
+        Nan::ThrowError("file is closed");
+        return false;
+    }
+    return true;
+}
+
 NAN_GETTER(GNFile::GetDirty) {
     Nan::HandleScope scope;
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (gn_file->cached) {
+        info.GetReturnValue().Set(Nan::False());
+        return;
+    }
     info.GetReturnValue().Set(Nan::New<Boolean>(gn_file->file->dirty));
 }
 
@@ -66,12 +130,24 @@ NAN_GETTER(GNFile::GetId) {
     Nan::HandleScope scope;
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
     char buf[64];
-    snprintf(buf, sizeof(buf), "%p", gn_file->file);
+    if (gn_file->cached) {
+        snprintf(buf, sizeof(buf), "%p", gn_file->cached);
+    } else {
+        snprintf(buf, sizeof(buf), "%p", gn_file->file);
+    }
     info.GetReturnValue().Set(Nan::New<String>(buf).ToLocalChecked());
 }
 
 NAN_GETTER(GNFile::GetFilename) {
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (gn_file->cached) {
+        info.GetReturnValue().Set(Nan::New<String>(gn_file->cached->filename).ToLocalChecked());
+        return;
+    }
+    if (!gn_file->path.empty()) {
+        info.GetReturnValue().Set(Nan::New<String>(gn_file->path).ToLocalChecked());
+        return;
+    }
     info.GetReturnValue().Set(Nan::New<String>(gn_file->file->filename).ToLocalChecked());
 }
 
@@ -93,6 +169,20 @@ NAN_METHOD(GNFile::GetMetadata) {
     }
 
     String::Utf8Value key_str(info[0]->ToString());
+
+    if (gn_file->cached) {
+        std::vector<std::pair<std::string, std::string> > &tags = gn_file->cached->tags;
+        bool match_case = (flags & GROOVE_TAG_MATCH_CASE);
+        for (size_t i = 0; i < tags.size(); i += 1) {
+            if (keys_equal(tags[i].first, *key_str, match_case)) {
+                info.GetReturnValue().Set(Nan::New<String>(tags[i].second).ToLocalChecked());
+                return;
+            }
+        }
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+
     GrooveTag *tag = groove_file_metadata_get(gn_file->file, *key_str, NULL, flags);
     if (tag) {
         info.GetReturnValue().Set(Nan::New<String>(groove_tag_value(tag)).ToLocalChecked());
@@ -104,6 +194,8 @@ NAN_METHOD(GNFile::GetMetadata) {
 
 NAN_METHOD(GNFile::SetMetadata) {
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (!require_open_file(gn_file))
+        return;
 
     if (info.Length() < 1 || !info[0]->IsString()) {
         Nan::ThrowTypeError("Expected string arg[0]");
@@ -136,6 +228,8 @@ NAN_METHOD(GNFile::SetMetadata) {
 
 NAN_METHOD(GNFile::OverrideDuration) {
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (!require_open_file(gn_file))
+        return;
 
     if (info.Length() < 1 || !info[0]->IsNumber()) {
         Nan::ThrowTypeError("Expected number arg[0]");
@@ -153,6 +247,16 @@ NAN_METHOD(GNFile::Metadata) {
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
     Local<Object> metadata = Nan::New<Object>();
 
+    if (gn_file->cached) {
+        std::vector<std::pair<std::string, std::string> > &tags = gn_file->cached->tags;
+        for (size_t i = 0; i < tags.size(); i += 1) {
+            Nan::Set(metadata, Nan::New<String>(tags[i].first).ToLocalChecked(),
+                    Nan::New<String>(tags[i].second).ToLocalChecked());
+        }
+        info.GetReturnValue().Set(metadata);
+        return;
+    }
+
     GrooveTag *tag = NULL;
     while ((tag = groove_file_metadata_get(gn_file->file, "", tag, 0))) {
         Nan::Set(metadata, Nan::New<String>(groove_tag_key(tag)).ToLocalChecked(),
@@ -165,31 +269,61 @@ NAN_METHOD(GNFile::Metadata) {
 NAN_METHOD(GNFile::ShortNames) {
     Nan::HandleScope scope;
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (gn_file->cached) {
+        info.GetReturnValue().Set(Nan::New<String>(gn_file->cached->short_names).ToLocalChecked());
+        return;
+    }
     info.GetReturnValue().Set(Nan::New<String>(groove_file_short_names(gn_file->file)).ToLocalChecked());
 }
 
 NAN_METHOD(GNFile::Duration) {
     Nan::HandleScope scope;
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (gn_file->cached) {
+        info.GetReturnValue().Set(Nan::New<Number>(gn_file->cached->duration));
+        return;
+    }
     info.GetReturnValue().Set(Nan::New<Number>(groove_file_duration(gn_file->file)));
 }
 
+NAN_METHOD(GNFile::AudioFormat) {
+    Nan::HandleScope scope;
+    GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (gn_file->cached) {
+        // the cache does not record it
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+    GrooveAudioFormat format;
+    groove_file_audio_format(gn_file->file, &format);
+    info.GetReturnValue().Set(GNDevice::NewAudioFormatObject(&format));
+}
+
 class CloseWorker : public Nan::AsyncWorker {
 public:
-    CloseWorker(Nan::Callback *callback, GrooveFile *file) : Nan::AsyncWorker(callback) {
+    CloseWorker(Nan::Callback *callback, GrooveFile *file, GNFileInfo *cached, GNFileIo *io) :
+        Nan::AsyncWorker(callback)
+    {
         this->file = file;
+        this->cached = cached;
+        this->io = io;
+    }
+    ~CloseWorker() {
+        delete cached;
     }
-    ~CloseWorker() {}
 
     void Execute() {
         if (file) {
             groove_file_destroy(file);
-        } else {
+            file_io_destroy(io);
+        } else if (!cached) {
             SetErrorMessage("file already closed");
         }
     }
 
     GrooveFile *file;
+    GNFileInfo *cached;
+    GNFileIo *io;
 };
 
 NAN_METHOD(GNFile::Close) {
@@ -202,47 +336,344 @@ NAN_METHOD(GNFile::Close) {
         return;
     }
 
+    if (gn_file->busy_count > 0) {
+        Nan::ThrowError("file is busy computing its exact duration");
+        return;
+    }
+
     Nan::Callback *callback = new Nan::Callback(info[0].As<Function>());
-    AsyncQueueWorker(new CloseWorker(callback, gn_file->file));
+
+    if (gn_file->pool) {
+        // the pool decides whether the file really gets closed
+        std::vector<GrooveFile *> evicted;
+        GNFilePool::Release(gn_file->pool, gn_file->file, &evicted);
+        GNFilePool::CloseFiles(evicted, callback);
+        gn_file->file = NULL;
+        gn_file->pool = NULL;
+        return;
+    }
+
+    CloseWorker *worker = new CloseWorker(callback, gn_file->file, gn_file->cached, gn_file->io);
+
+    // the io may be reading from this buffer until the file is destroyed
+    if (!gn_file->io_buffer.IsEmpty()) {
+        worker->SaveToPersistent("buffer", Nan::New(gn_file->io_buffer));
+        gn_file->io_buffer.Reset();
+    }
+    scheduler_queue(worker, GNPriorityInteractive);
 
     gn_file->file = NULL;
+    gn_file->cached = NULL;
+    gn_file->io = NULL;
 }
 
 class OpenWorker : public Nan::AsyncWorker {
 public:
-    OpenWorker(Nan::Callback *callback, String::Utf8Value *filename) : Nan::AsyncWorker(callback) {
+    OpenWorker(Nan::Callback *callback, String::Utf8Value *filename, bool metadata_only) :
+        Nan::AsyncWorker(callback)
+    {
         this->filename = filename;
+        this->metadata_only = metadata_only;
+        this->file = NULL;
+        this->cached = NULL;
+        this->io = NULL;
+        this->map_file = false;
+        this->has_buffer = false;
+        this->has_path = true;
+        this->pool = NULL;
+        this->size = 0;
+        this->probe_size = 0;
+        this->cancel = NULL;
     }
     ~OpenWorker() {
         delete filename;
+        delete cached;
+        file_io_destroy(io);
+        if (pool)
+            GNFilePool::Unref(pool);
+        cancel_state_unref(cancel);
     }
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
+
+        GNCacheKey key;
+        bool use_cache = metadata_only && metadata_cache_is_open() &&
+            metadata_cache_stat(**filename, &key) == 0;
+        if (use_cache) {
+            cached = new GNFileInfo();
+            if (metadata_cache_get(**filename, &key, cached))
+                return;
+            delete cached;
+            cached = NULL;
+        }
+
+        int err;
+        if (map_file && (err = file_io_create_mapped(**filename, &io))) {
+            SetErrorMessage(uv_strerror(err));
+            return;
+        }
+        // reading through our own io is what lets a cancel stop probing
+        bool use_prefetch = probe_size > 0 || cancel;
+        if (!io && use_prefetch && (err = file_io_create_prefetch(**filename, probe_size, &io))) {
+            SetErrorMessage(uv_strerror(err));
+            return;
+        }
+        if (io && cancel)
+            file_io_set_cancel(io, cancel);
+        const char *filename_hint = format_hint.empty() ? **filename : format_hint.c_str();
+
         file = groove_file_create(get_groove());
         if (!file) {
             SetErrorMessage(groove_strerror(GrooveErrorNoMem));
             return;
         }
-        int err;
-        if ((err = groove_file_open(file, **filename, **filename))) {
-            SetErrorMessage(groove_strerror(err));
+        if (io) {
+            err = groove_file_open_custom(file, &io->custom_io, filename_hint);
+        } else {
+            err = groove_file_open(file, **filename, filename_hint);
+        }
+        if (err) {
+            groove_file_destroy(file);
+            file = NULL;
+            SetErrorMessage(cancel_state_is_cancelled(cancel) ? "cancelled" : groove_strerror(err));
+            return;
+        }
+        if (cancel_state_is_cancelled(cancel)) {
+            groove_file_destroy(file);
+            file = NULL;
+            SetErrorMessage("cancelled");
             return;
         }
+        // the token only covers opening; nothing decodes from the io yet
+        if (io && cancel)
+            file_io_set_cancel(io, NULL);
+
+        if (use_cache) {
+            GNFileInfo file_info;
+            read_file_info(file, &file_info);
+            metadata_cache_put(**filename, &key, &file_info);
+        }
+
+        // the on-disk size stands in for the memory an open file costs
+        if (pool && metadata_cache_stat(**filename, &key) == 0)
+            size = key.size;
     }
 
     void HandleOKCallback() {
         Nan::HandleScope scope;
-        Local<Value> argv[] = {Nan::Null(), GNFile::NewInstance(file)};
+        Local<Value> fileObject;
+        if (cached) {
+            fileObject = GNFile::NewCachedInstance(cached);
+            cached = NULL;
+        } else {
+            fileObject = GNFile::NewInstance(file);
+            GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(fileObject->ToObject());
+            gn_file->io = io;
+            io = NULL;
+            if (has_path)
+                gn_file->path = **filename;
+            if (has_buffer)
+                gn_file->io_buffer.Reset(GetFromPersistent("buffer")->ToObject());
+            if (pool) {
+                GNFilePool::Add(pool, **filename, file, size);
+                gn_file->pool = pool;
+            }
+        }
+        Local<Value> argv[] = {Nan::Null(), fileObject};
         callback->Call(2, argv);
     }
 
     GrooveFile *file;
+    GNFileInfo *cached;
     String::Utf8Value *filename;
+    bool metadata_only;
+
+    // when set, the file is opened with this instead of by filename
+    GNFileIo *io;
+    bool map_file;
+    bool has_buffer;
+    // false when filename is only a format hint
+    bool has_path;
+
+    // when set, the opened file is handed out by this pool
+    GNFilePool::Pool *pool;
+    int64_t size;
+
+    // passed to libavformat in place of the file name when probing
+    std::string format_hint;
+    // when positive, this many bytes are read up front for probing
+    int64_t probe_size;
+
+    GNCancelState *cancel;
 };
 
+// libavformat guesses the format from the extension of the name it is
+// given, so a bare extension or short name such as "mp3" is made into a
+// file name.
+static std::string format_hint_file_name(const std::string &hint) {
+    if (hint.find('.') == std::string::npos)
+        return "hint." + hint;
+    return hint;
+}
+
 NAN_METHOD(GNFile::Open) {
     Nan::HandleScope scope;
 
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+
+    // options are optional
+    int cb_index = 1;
+    bool metadata_only = false;
+    GNPriority priority = GNPriorityInteractive;
+    std::string format_hint;
+    double probe_size = 0;
+    GNCancelState *cancel = NULL;
+    if (info.Length() >= 3) {
+        if (!info[1]->IsObject()) {
+            Nan::ThrowTypeError("Expected object arg[1]");
+            return;
+        }
+        Local<Object> options = info[1]->ToObject();
+        metadata_only = options->Get(Nan::New<String>("metadataOnly").ToLocalChecked())->BooleanValue();
+        priority = scheduler_get_priority(options, GNPriorityInteractive);
+
+        Local<Value> formatHintValue = options->Get(Nan::New<String>("formatHint").ToLocalChecked());
+        if (!formatHintValue->IsNull() && !formatHintValue->IsUndefined()) {
+            String::Utf8Value hint_str(formatHintValue->ToString());
+            format_hint = format_hint_file_name(*hint_str);
+        }
+
+        Local<Value> probeSizeValue = options->Get(Nan::New<String>("probeSizeBytes").ToLocalChecked());
+        if (!probeSizeValue->IsNull() && !probeSizeValue->IsUndefined()) {
+            probe_size = probeSizeValue->NumberValue();
+            if (probe_size < 0) {
+                Nan::ThrowTypeError("Expected probeSizeBytes to be at least 0");
+                return;
+            }
+        }
+
+        if (!GNCancelToken::FromOptions(options, &cancel))
+            return;
+        cb_index = 2;
+    }
+
+    if (info.Length() <= cb_index || !info[cb_index]->IsFunction()) {
+        cancel_state_unref(cancel);
+        Nan::ThrowTypeError("Expected function callback");
+        return;
+    }
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+    String::Utf8Value *filename = new String::Utf8Value(info[0]->ToString());
+    OpenWorker *worker = new OpenWorker(callback, filename, metadata_only);
+    worker->format_hint = format_hint;
+    worker->probe_size = (int64_t)probe_size;
+    worker->cancel = cancel;
+    scheduler_queue(worker, priority);
+}
+
+void GNFile::OpenForPool(GNFilePool::Pool *pool, String::Utf8Value *filename,
+        Nan::Callback *callback)
+{
+    OpenWorker *worker = new OpenWorker(callback, filename, false);
+    // keep the pool alive until the open finishes
+    pool->ref_count += 1;
+    worker->pool = pool;
+    scheduler_queue(worker, GNPriorityInteractive);
+}
+
+NAN_METHOD(GNFile::OpenBuffer) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+        Nan::ThrowTypeError("Expected Buffer arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[1]");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[2]");
+        return;
+    }
+
+    Local<Object> buffer = info[0]->ToObject();
+    Nan::Callback *callback = new Nan::Callback(info[2].As<Function>());
+    String::Utf8Value *format_hint = new String::Utf8Value(info[1]->ToString());
+    OpenWorker *worker = new OpenWorker(callback, format_hint, false);
+    worker->format_hint = format_hint_file_name(**format_hint);
+    worker->has_path = false;
+    worker->io = file_io_create_memory(node::Buffer::Data(buffer), node::Buffer::Length(buffer));
+    worker->SaveToPersistent("buffer", buffer);
+    worker->has_buffer = true;
+    scheduler_queue(worker, GNPriorityInteractive);
+}
+
+NAN_METHOD(GNFile::OpenStream) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[1]");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[2]");
+        return;
+    }
+    if (info.Length() < 4 || !info[3]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[3]");
+        return;
+    }
+
+    Local<Object> options = info[1]->ToObject();
+    int buffer_size = 1024 * 1024;
+    Local<Value> bufferSizeValue = options->Get(Nan::New<String>("bufferSize").ToLocalChecked());
+    if (!bufferSizeValue->IsNull() && !bufferSizeValue->IsUndefined()) {
+        buffer_size = (int)bufferSizeValue->NumberValue();
+    }
+    if (buffer_size < 1) {
+        Nan::ThrowTypeError("Expected bufferSize to be positive");
+        return;
+    }
+    GNCancelState *cancel;
+    if (!GNCancelToken::FromOptions(options, &cancel))
+        return;
+    GNFileIo *io = file_io_create_stream(buffer_size);
+    if (!io) {
+        cancel_state_unref(cancel);
+        Nan::ThrowError(groove_strerror(GrooveErrorNoMem));
+        return;
+    }
+
+    Nan::Callback *drain_cb = new Nan::Callback(info[2].As<Function>());
+    Local<Value> writer = GNStreamWriter::NewInstance(io, drain_cb);
+
+    Nan::Callback *callback = new Nan::Callback(info[3].As<Function>());
+    String::Utf8Value *format_hint = new String::Utf8Value(info[0]->ToString());
+    OpenWorker *worker = new OpenWorker(callback, format_hint, false);
+    worker->format_hint = format_hint_file_name(**format_hint);
+    worker->has_path = false;
+    worker->io = io;
+    worker->cancel = cancel;
+    scheduler_queue(worker, GNPriorityInteractive);
+
+    info.GetReturnValue().Set(writer);
+}
+
+NAN_METHOD(GNFile::OpenMapped) {
+    Nan::HandleScope scope;
+
     if (info.Length() < 1 || !info[0]->IsString()) {
         Nan::ThrowTypeError("Expected string arg[0]");
         return;
@@ -251,33 +682,575 @@ NAN_METHOD(GNFile::Open) {
         Nan::ThrowTypeError("Expected function arg[1]");
         return;
     }
+
     Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
     String::Utf8Value *filename = new String::Utf8Value(info[0]->ToString());
-    AsyncQueueWorker(new OpenWorker(callback, filename));
+    OpenWorker *worker = new OpenWorker(callback, filename, false);
+    worker->map_file = true;
+    scheduler_queue(worker, GNPriorityInteractive);
 }
 
 class SaveWorker : public Nan::AsyncWorker {
 public:
-    SaveWorker(Nan::Callback *callback, GrooveFile *file) : Nan::AsyncWorker(callback) {
+    SaveWorker(Nan::Callback *callback, GrooveFile *file, const std::string &path,
+            bool in_place, GNCancelState *cancel) :
+        Nan::AsyncWorker(callback)
+    {
         this->file = file;
+        this->path = path;
+        this->in_place = in_place;
+        this->method = "remux";
+        this->saved_in_place = false;
+        this->cancel = cancel;
+    }
+    ~SaveWorker() {
+        cancel_state_unref(cancel);
     }
-    ~SaveWorker() { }
 
     void Execute() {
+        // once writing has started it has to finish
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         int err;
-        if ((err = groove_file_save(file))) {
+        if (in_place) {
+            err = tag_writer_save_in_place(file, path.c_str());
+            if (err < 0) {
+                SetErrorMessage(uv_strerror(err));
+                return;
+            }
+            if (err == 1) {
+                method = "inPlace";
+                saved_in_place = true;
+                return;
+            }
+        }
+        // file->filename is the format hint when one was given
+        if ((err = groove_file_save_as(file, path.c_str()))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
     }
 
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+        // the getter reads this on the main thread
+        if (saved_in_place)
+            file->dirty = 0;
+        Local<Object> result = Nan::New<Object>();
+        Nan::Set(result, Nan::New<String>("method").ToLocalChecked(),
+                Nan::New<String>(method).ToLocalChecked());
+        Local<Value> argv[] = {Nan::Null(), result};
+        callback->Call(2, argv);
+    }
+
     GrooveFile *file;
+    std::string path;
+    bool in_place;
+    const char *method;
+    bool saved_in_place;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNFile::Save) {
     Nan::HandleScope scope;
 
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (!require_open_file(gn_file))
+        return;
+
+    // options are optional
+    int cb_index = 0;
+    bool in_place = true;
+    GNPriority priority = GNPriorityInteractive;
+    GNCancelState *cancel = NULL;
+    if (info.Length() >= 2) {
+        if (!info[0]->IsObject()) {
+            Nan::ThrowTypeError("Expected object arg[0]");
+            return;
+        }
+        Local<Object> options = info[0]->ToObject();
+        priority = scheduler_get_priority(options, GNPriorityInteractive);
+        Local<Value> inPlaceValue = options->Get(Nan::New<String>("inPlace").ToLocalChecked());
+        if (!inPlaceValue->IsNull() && !inPlaceValue->IsUndefined()) {
+            in_place = inPlaceValue->BooleanValue();
+        }
+        if (!GNCancelToken::FromOptions(options, &cancel))
+            return;
+        cb_index = 1;
+    }
+
+    if (info.Length() <= cb_index || !info[cb_index]->IsFunction()) {
+        cancel_state_unref(cancel);
+        Nan::ThrowTypeError("Expected function callback");
+        return;
+    }
+
+    // files opened from memory or a stream have no path to write to
+    if (gn_file->path.empty()) {
+        cancel_state_unref(cancel);
+        Nan::ThrowError("file was not opened from a path");
+        return;
+    }
+
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+    scheduler_queue(new SaveWorker(callback, gn_file->file, gn_file->path, in_place, cancel), priority);
+}
+
+// Decodes a private handle to the file, so that neither playback of the same
+// file nor anything else done with it on the main thread races with the
+// decoder. The handle may read through a clone of the file's io, which is why
+// close() is refused until the worker is done.
+class ExactDurationWorker : public Nan::AsyncWorker {
+public:
+    ExactDurationWorker(Nan::Callback *callback, GNFile *gn_file, bool fast) :
+        Nan::AsyncWorker(callback)
+    {
+        this->gn_file = gn_file;
+        this->path = gn_file->path;
+        this->filename_hint = gn_file->file->filename;
+        this->io = gn_file->io ? file_io_clone(gn_file->io) : NULL;
+        this->fast = fast;
+        this->duration = 0.0;
+        gn_file->busy_count += 1;
+    }
+    ~ExactDurationWorker() {
+        file_io_destroy(io);
+    }
+
+    void Execute() {
+        GrooveFile *file = groove_file_create(get_groove());
+        if (!file) {
+            SetErrorMessage(groove_strerror(GrooveErrorNoMem));
+            return;
+        }
+        int err = io ?
+            groove_file_open_custom(file, &io->custom_io, filename_hint.c_str()) :
+            groove_file_open(file, path.c_str(), filename_hint.c_str());
+        if (err) {
+            groove_file_destroy(file);
+            SetErrorMessage(groove_strerror(err));
+            return;
+        }
+        Decode(file);
+        groove_file_destroy(file);
+    }
+
+    void Decode(GrooveFile *file) {
+        GroovePlaylist *playlist = groove_playlist_create(get_groove());
+        GrooveSink *sink = groove_sink_create(get_groove());
+        if (!playlist || !sink) {
+            if (sink)
+                groove_sink_destroy(sink);
+            if (playlist)
+                groove_playlist_destroy(playlist);
+            SetErrorMessage(groove_strerror(GrooveErrorNoMem));
+            return;
+        }
+
+        if (fast) {
+            // count frames as they come out of the decoder
+            sink->disable_resample = 1;
+        } else {
+            sink->audio_format.sample_rate = 44100;
+            sink->audio_format.layout = *soundio_channel_layout_get_builtin(SoundIoChannelLayoutIdStereo);
+            sink->audio_format.format = SoundIoFormatFloat32NE;
+            sink->audio_format.is_planar = 0;
+        }
+        sink->buffer_size_bytes = 256 * 1024;
+
+        int err;
+        if ((err = groove_sink_attach(sink, playlist))) {
+            groove_sink_destroy(sink);
+            groove_playlist_destroy(playlist);
+            SetErrorMessage(groove_strerror(err));
+            return;
+        }
+        groove_playlist_insert(playlist, file, 1.0, 1.0, NULL);
+
+        GrooveBuffer *buffer;
+        while (groove_sink_buffer_get(sink, &buffer, 1) == GROOVE_BUFFER_YES) {
+            duration += buffer->frame_count / (double)buffer->format.sample_rate;
+            groove_buffer_unref(buffer);
+        }
+
+        groove_sink_detach(sink);
+        groove_sink_destroy(sink);
+        groove_playlist_destroy(playlist);
+    }
+
+    void HandleOKCallback() {
+        Nan::HandleScope scope;
+        gn_file->busy_count -= 1;
+        gn_file->file->override_duration = duration;
+        Local<Value> argv[] = {Nan::Null(), Nan::New<Number>(duration)};
+        callback->Call(2, argv);
+    }
+
+    void HandleErrorCallback() {
+        gn_file->busy_count -= 1;
+        Nan::AsyncWorker::HandleErrorCallback();
+    }
+
+    GNFile *gn_file;
+    std::string path;
+    // what the file was opened with, which is the format hint if one was
+    // given
+    std::string filename_hint;
+    GNFileIo *io;
+    bool fast;
+    double duration;
+};
+
+NAN_METHOD(GNFile::ComputeExactDuration) {
+    Nan::HandleScope scope;
+
+    GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info.This());
+    if (!require_open_file(gn_file))
+        return;
+
+    // options are optional
+    int cb_index = 0;
+    bool fast = true;
+    GNPriority priority = GNPriorityBackground;
+    if (info.Length() >= 2) {
+        if (!info[0]->IsObject()) {
+            Nan::ThrowTypeError("Expected object arg[0]");
+            return;
+        }
+        Local<Object> options = info[0]->ToObject();
+        priority = scheduler_get_priority(options, GNPriorityBackground);
+        Local<Value> fastValue = options->Get(Nan::New<String>("fast").ToLocalChecked());
+        if (!fastValue->IsNull() && !fastValue->IsUndefined()) {
+            fast = fastValue->BooleanValue();
+        }
+        cb_index = 1;
+    }
+
+    if (info.Length() <= cb_index || !info[cb_index]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function callback");
+        return;
+    }
+
+    // a stream cannot be read a second time
+    if (gn_file->io && !gn_file->io->clone) {
+        Nan::ThrowError("cannot compute the exact duration of a stream");
+        return;
+    }
+
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+    ExactDurationWorker *worker = new ExactDurationWorker(callback, gn_file, fast);
+    // keep the file object alive until the duration is applied
+    worker->SaveToPersistent("file", info.This());
+    scheduler_queue(worker, priority);
+}
+
+struct ScanResult {
+    int err;
+    GNFileInfo info;
+};
+
+static void scan_file(void *arg) {
+    ScanResult *result = reinterpret_cast<ScanResult *>(arg);
+    const char *filename = result->info.filename.c_str();
+
+    GNCacheKey key;
+    bool use_cache = metadata_cache_is_open() && metadata_cache_stat(filename, &key) == 0;
+    if (use_cache && metadata_cache_get(filename, &key, &result->info))
+        return;
+
+    GrooveFile *file = groove_file_create(get_groove());
+    if (!file) {
+        result->err = GrooveErrorNoMem;
+        return;
+    }
+    if ((result->err = groove_file_open(file, filename, filename))) {
+        groove_file_destroy(file);
+        return;
+    }
+    read_file_info(file, &result->info);
+    groove_file_destroy(file);
+
+    if (use_cache)
+        metadata_cache_put(filename, &key, &result->info);
+}
+
+static Local<Value> ScanResultToObject(void *arg) {
+    Nan::EscapableHandleScope scope;
+
+    ScanResult *result = reinterpret_cast<ScanResult *>(arg);
+
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New<String>("filename").ToLocalChecked(),
+            Nan::New<String>(result->info.filename).ToLocalChecked());
+    if (result->err) {
+        Nan::Set(object, Nan::New<String>("err").ToLocalChecked(),
+                Nan::Error(groove_strerror(result->err)));
+        return scope.Escape(object);
+    }
+    Nan::Set(object, Nan::New<String>("err").ToLocalChecked(), Nan::Null());
+    Nan::Set(object, Nan::New<String>("duration").ToLocalChecked(),
+            Nan::New<Number>(result->info.duration));
+    Nan::Set(object, Nan::New<String>("shortNames").ToLocalChecked(),
+            Nan::New<String>(result->info.short_names).ToLocalChecked());
+
+    std::vector<std::pair<std::string, std::string> > &tags = result->info.tags;
+    Local<Object> metadata = Nan::New<Object>();
+    for (size_t i = 0; i < tags.size(); i += 1) {
+        Nan::Set(metadata, Nan::New<String>(tags[i].first).ToLocalChecked(),
+                Nan::New<String>(tags[i].second).ToLocalChecked());
+    }
+    Nan::Set(object, Nan::New<String>("metadata").ToLocalChecked(), metadata);
+
+    return scope.Escape(object);
+}
+
+static void ScanResultDestroy(void *arg) {
+    delete reinterpret_cast<ScanResult *>(arg);
+}
+
+NAN_METHOD(GNFile::Scan) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsArray()) {
+        Nan::ThrowTypeError("Expected array arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[1]");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[2]");
+        return;
+    }
+    if (info.Length() < 4 || !info[3]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[3]");
+        return;
+    }
+
+    Local<Array> paths = Local<Array>::Cast(info[0]);
+    Local<Object> options = info[1]->ToObject();
+
+    int concurrency;
+    if (!batch_get_concurrency(options, &concurrency))
+        return;
+
+    int batch_size = 32;
+    Local<Value> batchSizeValue = options->Get(Nan::New<String>("batchSize").ToLocalChecked());
+    if (!batchSizeValue->IsNull() && !batchSizeValue->IsUndefined()) {
+        batch_size = (int)batchSizeValue->NumberValue();
+    }
+    if (batch_size < 1) {
+        Nan::ThrowTypeError("Expected batchSize to be at least 1");
+        return;
+    }
+
+    std::vector<void *> results;
+    results.reserve(paths->Length());
+    for (uint32_t i = 0; i < paths->Length(); i += 1) {
+        String::Utf8Value filename(paths->Get(i)->ToString());
+        ScanResult *result = new ScanResult();
+        result->err = 0;
+        result->info.filename = *filename;
+        result->info.duration = 0.0;
+        results.push_back(result);
+    }
+
+    batch_run(results, concurrency, batch_size, scheduler_get_priority(options, GNPriorityBackground),
+            scan_file, ScanResultToObject, ScanResultDestroy,
+            new Nan::Callback(info[2].As<Function>()), new Nan::Callback(info[3].As<Function>()));
+}
+
+struct TagWriteJob {
+    std::string filename;
+    std::vector<std::pair<std::string, std::string> > tags;
+    // set for tags which should be deleted instead
+    std::vector<bool> remove;
+    bool atomic;
+    bool fsync;
+    const char *err;
+    const char *method;
+};
+
+static void write_tags(void *arg) {
+    TagWriteJob *job = reinterpret_cast<TagWriteJob *>(arg);
+    const char *filename = job->filename.c_str();
+    GrooveFile *file = groove_file_create(get_groove());
+    if (!file) {
+        job->err = groove_strerror(GrooveErrorNoMem);
+        return;
+    }
+    int err;
+    if ((err = groove_file_open(file, filename, filename))) {
+        groove_file_destroy(file);
+        job->err = groove_strerror(err);
+        return;
+    }
+    for (size_t i = 0; i < job->tags.size(); i += 1) {
+        const char *value = job->remove[i] ? NULL : job->tags[i].second.c_str();
+        if (groove_file_metadata_set(file, job->tags[i].first.c_str(), value, 0) < 0) {
+            groove_file_destroy(file);
+            job->err = "set metadata failed";
+            return;
+        }
+    }
+
+    // libgroove remuxes into a temporary file and renames it over the
+    // original, so only skip that when the caller allows it
+    int in_place = job->atomic ? 0 : tag_writer_save_in_place(file, filename);
+    if (in_place < 0) {
+        groove_file_destroy(file);
+        job->err = uv_strerror(in_place);
+        return;
+    }
+    if (in_place) {
+        job->method = "inPlace";
+    } else if ((err = groove_file_save(file))) {
+        groove_file_destroy(file);
+        job->err = groove_strerror(err);
+        return;
+    }
+    groove_file_destroy(file);
+
+    if (job->fsync && (err = tag_writer_sync(filename, !in_place)))
+        job->err = uv_strerror(err);
+}
+
+static Local<Value> TagWriteJobToObject(void *arg) {
+    Nan::EscapableHandleScope scope;
+
+    TagWriteJob *job = reinterpret_cast<TagWriteJob *>(arg);
+    Local<Object> object = Nan::New<Object>();
+    Nan::Set(object, Nan::New<String>("path").ToLocalChecked(),
+            Nan::New<String>(job->filename).ToLocalChecked());
+    if (job->err) {
+        Nan::Set(object, Nan::New<String>("err").ToLocalChecked(), Nan::Error(job->err));
+    } else {
+        Nan::Set(object, Nan::New<String>("err").ToLocalChecked(), Nan::Null());
+        Nan::Set(object, Nan::New<String>("method").ToLocalChecked(),
+                Nan::New<String>(job->method).ToLocalChecked());
+    }
+    return scope.Escape(object);
+}
+
+static void TagWriteJobDestroy(void *arg) {
+    delete reinterpret_cast<TagWriteJob *>(arg);
+}
+
+NAN_METHOD(GNFile::WriteTags) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsArray()) {
+        Nan::ThrowTypeError("Expected array arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[1]");
+        return;
+    }
+    if (info.Length() < 3 || !info[2]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[2]");
+        return;
+    }
+    if (info.Length() < 4 || !info[3]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[3]");
+        return;
+    }
+
+    Local<Array> jobs = Local<Array>::Cast(info[0]);
+    Local<Object> options = info[1]->ToObject();
+
+    int concurrency;
+    if (!batch_get_concurrency(options, &concurrency))
+        return;
+
+    bool atomic = true;
+    Local<Value> atomicValue = options->Get(Nan::New<String>("atomic").ToLocalChecked());
+    if (!atomicValue->IsNull() && !atomicValue->IsUndefined()) {
+        atomic = atomicValue->BooleanValue();
+    }
+    bool fsync = options->Get(Nan::New<String>("fsync").ToLocalChecked())->BooleanValue();
+
+    std::vector<void *> parsed;
+    parsed.reserve(jobs->Length());
+    for (uint32_t i = 0; i < jobs->Length(); i += 1) {
+        Local<Value> jobValue = jobs->Get(i);
+        if (!jobValue->IsObject()) {
+            for (size_t j = 0; j < parsed.size(); j += 1) TagWriteJobDestroy(parsed[j]);
+            Nan::ThrowTypeError("Expected each job to be an object");
+            return;
+        }
+        Local<Object> jobObject = jobValue->ToObject();
+        Local<Value> pathValue = jobObject->Get(Nan::New<String>("path").ToLocalChecked());
+        Local<Value> tagsValue = jobObject->Get(Nan::New<String>("tags").ToLocalChecked());
+        if (!pathValue->IsString() || !tagsValue->IsObject()) {
+            for (size_t j = 0; j < parsed.size(); j += 1) TagWriteJobDestroy(parsed[j]);
+            Nan::ThrowTypeError("Expected each job to have a path string and a tags object");
+            return;
+        }
+
+        TagWriteJob *job = new TagWriteJob();
+        String::Utf8Value path_str(pathValue->ToString());
+        job->filename = *path_str;
+        job->atomic = atomic;
+        job->fsync = fsync;
+        job->err = NULL;
+        job->method = "remux";
+
+        Local<Object> tags = tagsValue->ToObject();
+        Local<Array> keys = tags->GetOwnPropertyNames();
+        for (uint32_t k = 0; k < keys->Length(); k += 1) {
+            Local<Value> key = keys->Get(k);
+            Local<Value> value = tags->Get(key);
+            String::Utf8Value key_str(key->ToString());
+            bool remove = value->IsNull() || value->IsUndefined();
+            String::Utf8Value value_str(remove ? Nan::EmptyString() : value->ToString());
+            job->tags.push_back(std::make_pair(std::string(*key_str), std::string(*value_str)));
+            job->remove.push_back(remove);
+        }
+        parsed.push_back(job);
+    }
+
+    // results are reported as each file is done
+    batch_run(parsed, concurrency, 1, scheduler_get_priority(options, GNPriorityBackground),
+            write_tags, TagWriteJobToObject, TagWriteJobDestroy,
+            new Nan::Callback(info[2].As<Function>()), new Nan::Callback(info[3].As<Function>()));
+}
+
+NAN_METHOD(GNFile::OpenMetadataCache) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+
+    String::Utf8Value filename(info[0]->ToString());
+    int err = metadata_cache_open(*filename);
+    if (err) {
+        Nan::ThrowError(uv_strerror(err));
+        return;
+    }
+}
+
+class SaveMetadataCacheWorker : public Nan::AsyncWorker {
+public:
+    SaveMetadataCacheWorker(Nan::Callback *callback) : Nan::AsyncWorker(callback) {}
+    ~SaveMetadataCacheWorker() {}
+
+    void Execute() {
+        int err;
+        if ((err = metadata_cache_save())) {
+            SetErrorMessage(uv_strerror(err));
+            return;
+        }
+    }
+};
+
+NAN_METHOD(GNFile::SaveMetadataCache) {
+    Nan::HandleScope scope;
 
     if (info.Length() < 1 || !info[0]->IsFunction()) {
         Nan::ThrowTypeError("Expected function arg[0]");
@@ -285,5 +1258,10 @@ NAN_METHOD(GNFile::Save) {
     }
 
     Nan::Callback *callback = new Nan::Callback(info[0].As<Function>());
-    AsyncQueueWorker(new SaveWorker(callback, gn_file->file));
+    scheduler_queue(new SaveMetadataCacheWorker(callback), GNPriorityBackground);
+}
+
+NAN_METHOD(GNFile::CloseMetadataCache) {
+    Nan::HandleScope scope;
+    metadata_cache_close();
 }
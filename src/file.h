@@ -3,16 +3,45 @@
 
 #include <node.h>
 #include <nan.h>
+#include <string>
 #include <groove/groove.h>
+#include "metadata_cache.h"
+#include "file_io.h"
+#include "file_pool.h"
 
 class GNFile : public node::ObjectWrap {
     public:
         static void Init();
         static v8::Local<v8::Value> NewInstance(GrooveFile *file);
+        static v8::Local<v8::Value> NewCachedInstance(GNFileInfo *cached);
 
         static NAN_METHOD(Open);
+        static NAN_METHOD(OpenBuffer);
+        static NAN_METHOD(OpenMapped);
+        static NAN_METHOD(OpenStream);
+        static NAN_METHOD(Scan);
+        static NAN_METHOD(WriteTags);
+        static NAN_METHOD(OpenMetadataCache);
+        static NAN_METHOD(SaveMetadataCache);
+        static NAN_METHOD(CloseMetadataCache);
+
+        static void OpenForPool(GNFilePool::Pool *pool, v8::String::Utf8Value *filename,
+                Nan::Callback *callback);
 
         GrooveFile *file;
+        // set instead of file when opened from the metadata cache
+        GNFileInfo *cached;
+        // the file on disk, or empty when it was opened from memory or a
+        // stream; file->filename is the format hint when one was given
+        std::string path;
+        // set when the file was not opened by filename
+        GNFileIo *io;
+        Nan::Persistent<v8::Object> io_buffer;
+        // set when the file was handed out by a file pool
+        GNFilePool::Pool *pool;
+        // computeExactDuration calls still reading through this file's io;
+        // close() is refused until they finish
+        int busy_count;
     private:
         GNFile();
         ~GNFile();
@@ -25,12 +54,14 @@ class GNFile : public node::ObjectWrap {
 
         static NAN_METHOD(Close);
         static NAN_METHOD(Duration);
+        static NAN_METHOD(AudioFormat);
         static NAN_METHOD(GetMetadata);
         static NAN_METHOD(SetMetadata);
         static NAN_METHOD(Metadata);
         static NAN_METHOD(ShortNames);
         static NAN_METHOD(Save);
         static NAN_METHOD(OverrideDuration);
+        static NAN_METHOD(ComputeExactDuration);
 };
 
 #endif
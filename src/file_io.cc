@@ -0,0 +1,532 @@
+#include <uv.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "file_io.h"
+
+// AVERROR_EOF. libgroove hands read results straight to libavformat.
+static const int io_eof = -0x20464F45;
+
+struct MemoryIo {
+    GNFileIo base;
+    const char *data;
+    int64_t size;
+    int64_t pos;
+#ifdef _WIN32
+    HANDLE mapping;
+#endif
+    bool mapped;
+};
+
+static int memory_read_packet(GrooveCustomIo *custom_io, uint8_t *buf, int buf_size) {
+    MemoryIo *io = reinterpret_cast<MemoryIo *>(custom_io->userdata);
+    if (cancel_state_is_cancelled(io->base.cancel))
+        return -1;
+    int64_t remaining = io->size - io->pos;
+    if (remaining <= 0)
+        return io_eof;
+    int amt = (remaining < buf_size) ? (int)remaining : buf_size;
+    memcpy(buf, io->data + io->pos, amt);
+    io->pos += amt;
+    return amt;
+}
+
+static int64_t memory_seek(GrooveCustomIo *custom_io, int64_t offset, int whence) {
+    MemoryIo *io = reinterpret_cast<MemoryIo *>(custom_io->userdata);
+    if (whence & GROOVE_SEEK_SIZE)
+        return io->size;
+
+    int64_t pos;
+    switch (whence & ~GROOVE_SEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = io->pos + offset;
+            break;
+        case SEEK_END:
+            pos = io->size + offset;
+            break;
+        default:
+            return -1;
+    }
+    if (pos < 0 || pos > io->size)
+        return -1;
+    io->pos = pos;
+    return pos;
+}
+
+static void memory_destroy(GNFileIo *base) {
+    MemoryIo *io = reinterpret_cast<MemoryIo *>(base);
+    if (io->mapped && io->size > 0) {
+#ifdef _WIN32
+        UnmapViewOfFile(io->data);
+        CloseHandle(io->mapping);
+#else
+        munmap(const_cast<char *>(io->data), io->size);
+#endif
+    }
+    delete io;
+}
+
+static GNFileIo *memory_clone(GNFileIo *base);
+
+static MemoryIo *create_memory_io(const char *data, int64_t size) {
+    MemoryIo *io = new MemoryIo;
+    io->base.custom_io.userdata = io;
+    io->base.custom_io.read_packet = memory_read_packet;
+    io->base.custom_io.write_packet = NULL;
+    io->base.custom_io.seek = memory_seek;
+    io->base.destroy = memory_destroy;
+    io->base.cancel = NULL;
+    io->base.clone = memory_clone;
+    io->data = data;
+    io->size = size;
+    io->pos = 0;
+    io->mapped = false;
+    return io;
+}
+
+static GNFileIo *memory_clone(GNFileIo *base) {
+    MemoryIo *io = reinterpret_cast<MemoryIo *>(base);
+    // not mapped, so that only the original unmaps
+    return &create_memory_io(io->data, io->size)->base;
+}
+
+GNFileIo *file_io_create_memory(const char *data, int64_t size) {
+    return &create_memory_io(data, size)->base;
+}
+
+int file_io_create_mapped(const char *filename, GNFileIo **out_io) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+            OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+        return UV_ENOENT;
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+        CloseHandle(file);
+        return UV_EIO;
+    }
+    const char *data = NULL;
+    HANDLE mapping = NULL;
+    if (size.QuadPart > 0) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping)
+            data = reinterpret_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        if (!data) {
+            if (mapping)
+                CloseHandle(mapping);
+            CloseHandle(file);
+            return UV_EIO;
+        }
+    }
+    CloseHandle(file);
+    MemoryIo *io = create_memory_io(data, size.QuadPart);
+    io->mapping = mapping;
+#else
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    const char *data = NULL;
+    if (st.st_size > 0) {
+        void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            int err = -errno;
+            close(fd);
+            return err;
+        }
+        data = reinterpret_cast<const char *>(base);
+    }
+    close(fd);
+    MemoryIo *io = create_memory_io(data, st.st_size);
+#endif
+    io->mapped = true;
+    *out_io = &io->base;
+    return 0;
+}
+
+/* Reads the head of the file with a single request up front. Probing the
+ * container then never goes back to the disk, which matters most on network
+ * filesystems where each small read is a round trip.
+ */
+struct PrefetchIo {
+    GNFileIo base;
+    uv_file fd;
+    bool owns_fd;
+    char *head;
+    int64_t head_size;
+    int64_t size;
+    int64_t pos;
+};
+
+static int read_at(uv_file fd, char *dest, int64_t size, int64_t offset) {
+    int64_t total = 0;
+    while (total < size) {
+        uv_buf_t buf = uv_buf_init(dest + total, (unsigned int)(size - total));
+        uv_fs_t req;
+        int amt = uv_fs_read(uv_default_loop(), &req, fd, &buf, 1, offset + total, NULL);
+        uv_fs_req_cleanup(&req);
+        if (amt < 0)
+            return amt;
+        if (amt == 0)
+            break;
+        total += amt;
+    }
+    return (int)total;
+}
+
+static int prefetch_read_packet(GrooveCustomIo *custom_io, uint8_t *buf, int buf_size) {
+    PrefetchIo *io = reinterpret_cast<PrefetchIo *>(custom_io->userdata);
+    if (cancel_state_is_cancelled(io->base.cancel))
+        return -1;
+    if (io->pos >= io->size)
+        return io_eof;
+    if (io->pos < io->head_size) {
+        int64_t remaining = io->head_size - io->pos;
+        int amt = (remaining < buf_size) ? (int)remaining : buf_size;
+        memcpy(buf, io->head + io->pos, amt);
+        io->pos += amt;
+        return amt;
+    }
+    int amt = read_at(io->fd, reinterpret_cast<char *>(buf), buf_size, io->pos);
+    if (amt < 0)
+        return -1;
+    if (amt == 0)
+        return io_eof;
+    io->pos += amt;
+    return amt;
+}
+
+static int64_t prefetch_seek(GrooveCustomIo *custom_io, int64_t offset, int whence) {
+    PrefetchIo *io = reinterpret_cast<PrefetchIo *>(custom_io->userdata);
+    if (whence & GROOVE_SEEK_SIZE)
+        return io->size;
+
+    int64_t pos;
+    switch (whence & ~GROOVE_SEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = io->pos + offset;
+            break;
+        case SEEK_END:
+            pos = io->size + offset;
+            break;
+        default:
+            return -1;
+    }
+    if (pos < 0)
+        return -1;
+    io->pos = pos;
+    return pos;
+}
+
+static void prefetch_destroy(GNFileIo *base) {
+    PrefetchIo *io = reinterpret_cast<PrefetchIo *>(base);
+    if (io->owns_fd) {
+        uv_fs_t req;
+        uv_fs_close(uv_default_loop(), &req, io->fd, NULL);
+        uv_fs_req_cleanup(&req);
+    }
+    free(io->head);
+    delete io;
+}
+
+static GNFileIo *prefetch_clone(GNFileIo *base);
+
+static PrefetchIo *create_prefetch_io(uv_file fd, bool owns_fd, char *head,
+        int64_t head_size, int64_t size)
+{
+    PrefetchIo *io = new PrefetchIo;
+    io->base.custom_io.userdata = io;
+    io->base.custom_io.read_packet = prefetch_read_packet;
+    io->base.custom_io.write_packet = NULL;
+    io->base.custom_io.seek = prefetch_seek;
+    io->base.destroy = prefetch_destroy;
+    io->base.cancel = NULL;
+    io->base.clone = prefetch_clone;
+    io->fd = fd;
+    io->owns_fd = owns_fd;
+    io->head = head;
+    io->head_size = head_size;
+    io->size = size;
+    io->pos = 0;
+    return io;
+}
+
+static GNFileIo *prefetch_clone(GNFileIo *base) {
+    PrefetchIo *io = reinterpret_cast<PrefetchIo *>(base);
+    // reads are positioned, so sharing the descriptor is safe
+    return &create_prefetch_io(io->fd, false, NULL, 0, io->size)->base;
+}
+
+int file_io_create_prefetch(const char *filename, int64_t prefetch_size, GNFileIo **out_io) {
+    uv_fs_t req;
+    uv_file fd = uv_fs_open(uv_default_loop(), &req, filename, O_RDONLY, 0, NULL);
+    uv_fs_req_cleanup(&req);
+    if (fd < 0)
+        return fd;
+
+    int err = uv_fs_fstat(uv_default_loop(), &req, fd, NULL);
+    int64_t size = req.statbuf.st_size;
+    uv_fs_req_cleanup(&req);
+    if (err) {
+        uv_fs_close(uv_default_loop(), &req, fd, NULL);
+        uv_fs_req_cleanup(&req);
+        return err;
+    }
+
+    int64_t head_size = (prefetch_size < size) ? prefetch_size : size;
+    char *head = reinterpret_cast<char *>(malloc(head_size > 0 ? head_size : 1));
+    int amt = head ? read_at(fd, head, head_size, 0) : UV_ENOMEM;
+    if (amt < 0) {
+        free(head);
+        uv_fs_close(uv_default_loop(), &req, fd, NULL);
+        uv_fs_req_cleanup(&req);
+        return amt;
+    }
+
+    *out_io = &create_prefetch_io(fd, true, head, amt, size)->base;
+    return 0;
+}
+
+void file_io_destroy(GNFileIo *io) {
+    if (!io)
+        return;
+    cancel_state_unref(io->cancel);
+    io->destroy(io);
+}
+
+GNFileIo *file_io_clone(GNFileIo *io) {
+    return io->clone ? io->clone(io) : NULL;
+}
+
+void file_io_set_cancel(GNFileIo *io, GNCancelState *cancel) {
+    cancel_state_ref(cancel);
+    cancel_state_unref(io->cancel);
+    io->cancel = cancel;
+}
+
+/* The ring keeps bytes which have already been read until the writer needs
+ * the room, so that the demuxer can seek backwards a little, which it does
+ * while probing. Positions are absolute offsets into the stream.
+ */
+static const uint64_t stream_cancel_poll_ns = 10 * 1000 * 1000;
+
+struct StreamIo {
+    GNFileIo base;
+    uv_mutex_t mutex;
+    uv_cond_t cond;
+    char *ring;
+    int64_t capacity;
+    int64_t write_pos;
+    int64_t read_pos;
+    bool ended;
+    bool aborted;
+    bool reader_closed;
+    bool writer_waiting;
+    uv_async_t *drain_async;
+    int ref_count;
+};
+
+static void stream_unref(StreamIo *io) {
+    uv_mutex_lock(&io->mutex);
+    io->ref_count -= 1;
+    bool last = (io->ref_count == 0);
+    uv_mutex_unlock(&io->mutex);
+    if (!last)
+        return;
+    uv_cond_destroy(&io->cond);
+    uv_mutex_destroy(&io->mutex);
+    free(io->ring);
+    delete io;
+}
+
+static int stream_read_packet(GrooveCustomIo *custom_io, uint8_t *buf, int buf_size) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(custom_io->userdata);
+    uv_mutex_lock(&io->mutex);
+    while (io->read_pos == io->write_pos && !io->ended) {
+        if (cancel_state_is_cancelled(io->base.cancel)) {
+            uv_mutex_unlock(&io->mutex);
+            return -1;
+        }
+        // cancelling does not signal the cond, so look again now and then
+        if (io->base.cancel) {
+            uv_cond_timedwait(&io->cond, &io->mutex, stream_cancel_poll_ns);
+        } else {
+            uv_cond_wait(&io->cond, &io->mutex);
+        }
+    }
+    if (cancel_state_is_cancelled(io->base.cancel)) {
+        uv_mutex_unlock(&io->mutex);
+        return -1;
+    }
+
+    // what arrived before the error may be truncated anywhere, so do not
+    // let the decoder mistake it for a complete file
+    if (io->aborted) {
+        uv_mutex_unlock(&io->mutex);
+        return -1;
+    }
+    int64_t available = io->write_pos - io->read_pos;
+    if (available == 0) {
+        uv_mutex_unlock(&io->mutex);
+        return io_eof;
+    }
+    int amt = (available < buf_size) ? (int)available : buf_size;
+    int64_t start = io->read_pos % io->capacity;
+    int64_t first = io->capacity - start;
+    if (first > amt)
+        first = amt;
+    memcpy(buf, io->ring + start, first);
+    memcpy(buf + first, io->ring, amt - first);
+    io->read_pos += amt;
+
+    if (io->writer_waiting && io->drain_async) {
+        io->writer_waiting = false;
+        uv_async_send(io->drain_async);
+    }
+    uv_mutex_unlock(&io->mutex);
+    return amt;
+}
+
+static int64_t stream_seek(GrooveCustomIo *custom_io, int64_t offset, int whence) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(custom_io->userdata);
+    // the size of a stream is not known
+    if (whence & GROOVE_SEEK_SIZE)
+        return -1;
+
+    uv_mutex_lock(&io->mutex);
+    int64_t pos;
+    switch (whence & ~GROOVE_SEEK_FORCE) {
+        case SEEK_SET:
+            pos = offset;
+            break;
+        case SEEK_CUR:
+            pos = io->read_pos + offset;
+            break;
+        default:
+            uv_mutex_unlock(&io->mutex);
+            return -1;
+    }
+    // only what is still in the ring can be reached
+    int64_t oldest = io->write_pos - io->capacity;
+    if (pos < 0 || pos < oldest || pos > io->write_pos) {
+        uv_mutex_unlock(&io->mutex);
+        return -1;
+    }
+    io->read_pos = pos;
+    uv_mutex_unlock(&io->mutex);
+    return pos;
+}
+
+static void stream_destroy(GNFileIo *base) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    uv_mutex_lock(&io->mutex);
+    io->reader_closed = true;
+    // nobody will read the rest, so let the writer finish
+    if (io->writer_waiting && io->drain_async) {
+        io->writer_waiting = false;
+        uv_async_send(io->drain_async);
+    }
+    uv_mutex_unlock(&io->mutex);
+    stream_unref(io);
+}
+
+GNFileIo *file_io_create_stream(int capacity) {
+    StreamIo *io = new StreamIo;
+    io->ring = reinterpret_cast<char *>(malloc(capacity));
+    if (!io->ring) {
+        delete io;
+        return NULL;
+    }
+    io->base.custom_io.userdata = io;
+    io->base.custom_io.read_packet = stream_read_packet;
+    io->base.custom_io.write_packet = NULL;
+    io->base.custom_io.seek = stream_seek;
+    io->base.destroy = stream_destroy;
+    io->base.cancel = NULL;
+    io->base.clone = NULL;
+    uv_mutex_init(&io->mutex);
+    uv_cond_init(&io->cond);
+    io->capacity = capacity;
+    io->write_pos = 0;
+    io->read_pos = 0;
+    io->ended = false;
+    io->aborted = false;
+    io->reader_closed = false;
+    io->writer_waiting = false;
+    io->drain_async = NULL;
+    io->ref_count = 2;
+    return &io->base;
+}
+
+int file_io_stream_write(GNFileIo *base, const char *data, int size) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    uv_mutex_lock(&io->mutex);
+    if (io->reader_closed || io->ended) {
+        uv_mutex_unlock(&io->mutex);
+        return size;
+    }
+    int64_t room = io->capacity - (io->write_pos - io->read_pos);
+    int amt = (room < size) ? (int)room : size;
+    int64_t start = io->write_pos % io->capacity;
+    int64_t first = io->capacity - start;
+    if (first > amt)
+        first = amt;
+    memcpy(io->ring + start, data, first);
+    memcpy(io->ring, data + first, amt - first);
+    io->write_pos += amt;
+    io->writer_waiting = (amt < size);
+    uv_cond_signal(&io->cond);
+    uv_mutex_unlock(&io->mutex);
+    return amt;
+}
+
+void file_io_stream_end(GNFileIo *base) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    uv_mutex_lock(&io->mutex);
+    io->ended = true;
+    uv_cond_signal(&io->cond);
+    uv_mutex_unlock(&io->mutex);
+}
+
+void file_io_stream_abort(GNFileIo *base) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    uv_mutex_lock(&io->mutex);
+    io->ended = true;
+    io->aborted = true;
+    uv_cond_signal(&io->cond);
+    uv_mutex_unlock(&io->mutex);
+}
+
+void file_io_stream_set_drain_async(GNFileIo *base, uv_async_t *drain_async) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    uv_mutex_lock(&io->mutex);
+    io->drain_async = drain_async;
+    uv_mutex_unlock(&io->mutex);
+}
+
+void file_io_stream_release(GNFileIo *base) {
+    StreamIo *io = reinterpret_cast<StreamIo *>(base);
+    file_io_stream_end(base);
+    file_io_stream_set_drain_async(base, NULL);
+    stream_unref(io);
+}
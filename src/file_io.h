@@ -0,0 +1,58 @@
+#ifndef GN_FILE_IO_H
+#define GN_FILE_IO_H
+
+#include <stdint.h>
+#include <uv.h>
+#include <groove/groove.h>
+#include "cancel_token.h"
+
+// A GrooveCustomIo along with whatever backs it. It must outlive the
+// GrooveFile which was opened with it.
+struct GNFileIo {
+    GrooveCustomIo custom_io;
+    void (*destroy)(GNFileIo *io);
+    // when cancelled, reads fail so that probing gives up early. Only set
+    // while opening; a cancel after that must not cut decoding short.
+    GNCancelState *cancel;
+    // NULL when the data can only be read once
+    GNFileIo *(*clone)(GNFileIo *io);
+};
+
+// Reads from memory owned by the caller, which must stay valid until the
+// io is destroyed.
+GNFileIo *file_io_create_memory(const char *data, int64_t size);
+
+// Maps filename into memory and reads from the mapping.
+// Returns 0 or a negative libuv error code.
+int file_io_create_mapped(const char *filename, GNFileIo **out_io);
+
+// Reads filename, fetching the first prefetch_size bytes in one request so
+// that probing the format does not issue many small reads.
+// Returns 0 or a negative libuv error code.
+int file_io_create_prefetch(const char *filename, int64_t prefetch_size, GNFileIo **out_io);
+
+void file_io_destroy(GNFileIo *io);
+
+// Returns a second io over the same data with its own read position, or NULL
+// if io cannot be read twice. The clone borrows from io, so io must outlive
+// it.
+GNFileIo *file_io_clone(GNFileIo *io);
+
+// cancel may be NULL to detach the current token.
+void file_io_set_cancel(GNFileIo *io, GNCancelState *cancel);
+
+// Reads from a bounded ring buffer which is filled from the main thread with
+// file_io_stream_write. Reads block until data arrives or the stream ends.
+// file_io_destroy releases the reading side; file_io_stream_release releases
+// the writing side. The io is freed when both have been released.
+GNFileIo *file_io_create_stream(int capacity);
+// Returns how many bytes were accepted. If fewer than size, drain_async is
+// sent once there is room again.
+int file_io_stream_write(GNFileIo *io, const char *data, int size);
+void file_io_stream_end(GNFileIo *io);
+// Ends the stream with an error; every read from then on fails.
+void file_io_stream_abort(GNFileIo *io);
+void file_io_stream_set_drain_async(GNFileIo *io, uv_async_t *drain_async);
+void file_io_stream_release(GNFileIo *io);
+
+#endif
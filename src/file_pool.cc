@@ -0,0 +1,288 @@
+#include <node.h>
+#include "file_pool.h"
+#include "env.h"
+#include "file.h"
+#include "scheduler.h"
+
+using namespace v8;
+
+GNFilePool::GNFilePool() : pool(NULL) {};
+GNFilePool::~GNFilePool() {
+    if (!pool)
+        return;
+    // files still handed out keep the pool alive; they are closed when
+    // they are given back.
+    pool->closed = true;
+    std::vector<GrooveFile *> evicted;
+    std::list<Entry *>::iterator it;
+    for (it = pool->lru.begin(); it != pool->lru.end(); ++it) {
+        evicted.push_back((*it)->file);
+        delete *it;
+    }
+    pool->lru.clear();
+    pool->idle.clear();
+    CloseFiles(evicted, NULL);
+    Unref(pool);
+};
+
+static GNEnvPersistent<v8::Function> constructor;
+
+void GNFilePool::Init() {
+    // Prepare constructor template
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(Nan::New<String>("GrooveFilePool").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Methods
+    Nan::SetPrototypeMethod(tpl, "_acquire", Acquire);
+    Nan::SetPrototypeMethod(tpl, "_open", Open);
+    Nan::SetPrototypeMethod(tpl, "clear", Clear);
+    Nan::SetPrototypeMethod(tpl, "stats", Stats);
+
+    constructor.Reset(tpl->GetFunction());
+}
+
+NAN_METHOD(GNFilePool::New) {
+    Nan::HandleScope scope;
+    assert(info.IsConstructCall());
+
+    GNFilePool *obj = new GNFilePool();
+    obj->Wrap(info.This());
+
+    info.GetReturnValue().Set(info.This());
+}
+
+Local<Value> GNFilePool::NewInstance() {
+    Nan::EscapableHandleScope scope;
+
+    Local<Function> cons = constructor.Get();
+    Local<Object> instance = cons->NewInstance();
+
+    return scope.Escape(instance);
+}
+
+class PoolCloseWorker : public Nan::AsyncWorker {
+public:
+    PoolCloseWorker(Nan::Callback *callback, const std::vector<GrooveFile *> &files) :
+        Nan::AsyncWorker(callback), files(files) {}
+    ~PoolCloseWorker() {}
+
+    void Execute() {
+        for (size_t i = 0; i < files.size(); i += 1) {
+            groove_file_destroy(files[i]);
+        }
+    }
+
+    void HandleOKCallback() {
+        if (!callback)
+            return;
+        Nan::HandleScope scope;
+        Local<Value> argv[] = {Nan::Null()};
+        callback->Call(1, argv);
+    }
+
+    std::vector<GrooveFile *> files;
+};
+
+void GNFilePool::CloseFiles(const std::vector<GrooveFile *> &files, Nan::Callback *callback) {
+    if (files.empty() && !callback)
+        return;
+    scheduler_queue(new PoolCloseWorker(callback, files), GNPriorityBackground);
+}
+
+static void evict(GNFilePool::Pool *pool, GNFilePool::Entry *entry,
+        std::vector<GrooveFile *> *evicted)
+{
+    pool->open_count -= 1;
+    pool->open_bytes -= entry->size;
+    evicted->push_back(entry->file);
+    delete entry;
+}
+
+static void remove_idle(GNFilePool::Pool *pool, std::list<GNFilePool::Entry *>::iterator lru_it) {
+    typedef std::unordered_multimap<std::string, std::list<GNFilePool::Entry *>::iterator> IdleMap;
+    std::pair<IdleMap::iterator, IdleMap::iterator> range = pool->idle.equal_range((*lru_it)->filename);
+    for (IdleMap::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == lru_it) {
+            pool->idle.erase(it);
+            break;
+        }
+    }
+    pool->lru.erase(lru_it);
+}
+
+static void trim(GNFilePool::Pool *pool, std::vector<GrooveFile *> *evicted) {
+    while (!pool->lru.empty() && (pool->open_count > pool->max_open ||
+                (pool->max_bytes > 0 && pool->open_bytes > pool->max_bytes)))
+    {
+        std::list<GNFilePool::Entry *>::iterator lru_it = --pool->lru.end();
+        GNFilePool::Entry *entry = *lru_it;
+        remove_idle(pool, lru_it);
+        evict(pool, entry, evicted);
+    }
+}
+
+void GNFilePool::Add(Pool *pool, const char *filename, GrooveFile *file, int64_t size) {
+    Entry *entry = new Entry();
+    entry->filename = filename;
+    entry->file = file;
+    entry->size = size;
+    pool->in_use[file] = entry;
+    pool->open_count += 1;
+    pool->open_bytes += size;
+    pool->ref_count += 1;
+}
+
+void GNFilePool::Release(Pool *pool, GrooveFile *file, std::vector<GrooveFile *> *evicted) {
+    std::unordered_map<GrooveFile *, Entry *>::iterator it = pool->in_use.find(file);
+    assert(it != pool->in_use.end());
+    Entry *entry = it->second;
+    pool->in_use.erase(it);
+
+    // a file with unsaved changes is not what the next caller asked for
+    if (pool->closed || file->dirty) {
+        evict(pool, entry, evicted);
+    } else {
+        pool->lru.push_front(entry);
+        pool->idle.insert(std::make_pair(entry->filename, pool->lru.begin()));
+        trim(pool, evicted);
+    }
+    Unref(pool);
+}
+
+void GNFilePool::Unref(Pool *pool) {
+    pool->ref_count -= 1;
+    if (pool->ref_count == 0)
+        delete pool;
+}
+
+NAN_METHOD(GNFilePool::Create) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    Local<Object> options = info[0]->ToObject();
+
+    int max_open = 64;
+    Local<Value> maxOpenValue = options->Get(Nan::New<String>("maxOpen").ToLocalChecked());
+    if (!maxOpenValue->IsNull() && !maxOpenValue->IsUndefined()) {
+        max_open = (int)maxOpenValue->NumberValue();
+    }
+    if (max_open < 0) {
+        Nan::ThrowTypeError("Expected maxOpen to be at least 0");
+        return;
+    }
+
+    double max_bytes = 0;
+    Local<Value> maxBytesValue = options->Get(Nan::New<String>("maxBytes").ToLocalChecked());
+    if (!maxBytesValue->IsNull() && !maxBytesValue->IsUndefined()) {
+        max_bytes = maxBytesValue->NumberValue();
+    }
+    if (max_bytes < 0) {
+        Nan::ThrowTypeError("Expected maxBytes to be at least 0");
+        return;
+    }
+
+    Local<Value> instance = NewInstance();
+    GNFilePool *gn_pool = node::ObjectWrap::Unwrap<GNFilePool>(instance->ToObject());
+
+    Pool *pool = new Pool();
+    pool->max_open = max_open;
+    pool->max_bytes = (int64_t)max_bytes;
+    pool->open_count = 0;
+    pool->open_bytes = 0;
+    pool->closed = false;
+    pool->ref_count = 1;
+    gn_pool->pool = pool;
+
+    info.GetReturnValue().Set(instance);
+}
+
+NAN_METHOD(GNFilePool::Acquire) {
+    Nan::HandleScope scope;
+    GNFilePool *gn_pool = node::ObjectWrap::Unwrap<GNFilePool>(info.This());
+    Pool *pool = gn_pool->pool;
+
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+
+    String::Utf8Value filename(info[0]->ToString());
+    typedef std::unordered_multimap<std::string, std::list<Entry *>::iterator> IdleMap;
+    IdleMap::iterator it = pool->idle.find(*filename);
+    if (it == pool->idle.end()) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+
+    std::list<Entry *>::iterator lru_it = it->second;
+    Entry *entry = *lru_it;
+    pool->idle.erase(it);
+    pool->lru.erase(lru_it);
+    pool->in_use[entry->file] = entry;
+    pool->ref_count += 1;
+
+    Local<Value> fileObject = GNFile::NewInstance(entry->file);
+    GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(fileObject->ToObject());
+    gn_file->pool = pool;
+
+    info.GetReturnValue().Set(fileObject);
+}
+
+NAN_METHOD(GNFilePool::Open) {
+    Nan::HandleScope scope;
+    GNFilePool *gn_pool = node::ObjectWrap::Unwrap<GNFilePool>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsString()) {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[1]");
+        return;
+    }
+
+    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+    String::Utf8Value *filename = new String::Utf8Value(info[0]->ToString());
+    GNFile::OpenForPool(gn_pool->pool, filename, callback);
+}
+
+NAN_METHOD(GNFilePool::Clear) {
+    Nan::HandleScope scope;
+    GNFilePool *gn_pool = node::ObjectWrap::Unwrap<GNFilePool>(info.This());
+    Pool *pool = gn_pool->pool;
+
+    Nan::Callback *callback = NULL;
+    if (info.Length() >= 1) {
+        if (!info[0]->IsFunction()) {
+            Nan::ThrowTypeError("Expected function arg[0]");
+            return;
+        }
+        callback = new Nan::Callback(info[0].As<Function>());
+    }
+
+    std::vector<GrooveFile *> evicted;
+    std::list<Entry *>::iterator it;
+    for (it = pool->lru.begin(); it != pool->lru.end(); ++it) {
+        evict(pool, *it, &evicted);
+    }
+    pool->lru.clear();
+    pool->idle.clear();
+    CloseFiles(evicted, callback);
+}
+
+NAN_METHOD(GNFilePool::Stats) {
+    Nan::HandleScope scope;
+    GNFilePool *gn_pool = node::ObjectWrap::Unwrap<GNFilePool>(info.This());
+    Pool *pool = gn_pool->pool;
+
+    Local<Object> stats = Nan::New<Object>();
+    Nan::Set(stats, Nan::New<String>("open").ToLocalChecked(), Nan::New<Number>(pool->open_count));
+    Nan::Set(stats, Nan::New<String>("idle").ToLocalChecked(), Nan::New<Number>(pool->lru.size()));
+    Nan::Set(stats, Nan::New<String>("bytes").ToLocalChecked(), Nan::New<Number>(pool->open_bytes));
+
+    info.GetReturnValue().Set(stats);
+}
@@ -0,0 +1,62 @@
+#ifndef GN_FILE_POOL_H
+#define GN_FILE_POOL_H
+
+#include <node.h>
+#include <nan.h>
+#include <groove/groove.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class GNFilePool : public node::ObjectWrap {
+    public:
+        static void Init();
+        static v8::Local<v8::Value> NewInstance();
+
+        static NAN_METHOD(Create);
+
+        struct Entry {
+            std::string filename;
+            GrooveFile *file;
+            int64_t size;
+        };
+
+        // All of this is only touched from the main thread.
+        struct Pool {
+            int max_open;
+            int64_t max_bytes;
+            int open_count;
+            int64_t open_bytes;
+            // idle entries, most recently used first
+            std::list<Entry *> lru;
+            std::unordered_multimap<std::string, std::list<Entry *>::iterator> idle;
+            std::unordered_map<GrooveFile *, Entry *> in_use;
+            bool closed;
+            // one for the GNFilePool plus one per file handed out
+            int ref_count;
+        };
+
+        // takes ownership of file, which was just opened, as in use
+        static void Add(Pool *pool, const char *filename, GrooveFile *file, int64_t size);
+        // gives back a file handed out by the pool. any files which should be
+        // closed as a result are appended to evicted.
+        static void Release(Pool *pool, GrooveFile *file, std::vector<GrooveFile *> *evicted);
+        static void Unref(Pool *pool);
+        // destroys files on a worker thread, then calls callback if not NULL
+        static void CloseFiles(const std::vector<GrooveFile *> &files, Nan::Callback *callback);
+
+        Pool *pool;
+    private:
+        GNFilePool();
+        ~GNFilePool();
+
+        static NAN_METHOD(New);
+
+        static NAN_METHOD(Acquire);
+        static NAN_METHOD(Open);
+        static NAN_METHOD(Clear);
+        static NAN_METHOD(Stats);
+};
+
+#endif
@@ -1,18 +1,29 @@
 #include "fingerprinter.h"
+#include "env.h"
 #include "playlist_item.h"
 #include "playlist.h"
 #include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
 
 using namespace v8;
 
 GNFingerprinter::GNFingerprinter() {};
 GNFingerprinter::~GNFingerprinter() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    position_view_destroy(event_context->position_view);
     groove_fingerprinter_destroy(printer);
     delete event_context->event_cb;
     delete event_context;
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *sink, GroovePlaylistItem **item, double *pos) {
+    groove_fingerprinter_position(reinterpret_cast<GrooveFingerprinter *>(sink), item, pos);
+}
 
 void GNFingerprinter::Init() {
     // Prepare constructor template
@@ -25,6 +36,7 @@ void GNFingerprinter::Init() {
     Nan::SetPrototypeMethod(tpl, "detach", Detach);
     Nan::SetPrototypeMethod(tpl, "getInfo", GetInfo);
     Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -41,7 +53,7 @@ NAN_METHOD(GNFingerprinter::New) {
 Local<Value> GNFingerprinter::NewInstance(GrooveFingerprinter *printer) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNFingerprinter *gn_printer = node::ObjectWrap::Unwrap<GNFingerprinter>(instance);
@@ -72,6 +84,8 @@ NAN_METHOD(GNFingerprinter::Create) {
     gn_printer->event_context = context;
     context->event_cb = new Nan::Callback(info[0].As<Function>());
     context->printer = printer;
+    context->event_source = NULL;
+    context->position_view = position_view_create(printer, PositionFn);
 
 
     Nan::Set(instance, Nan::New<String>("infoQueueSize").ToLocalChecked(),
@@ -136,10 +150,15 @@ NAN_METHOD(GNFingerprinter::GetInfo) {
     }
 }
 
-static void PrinterEventAsyncCb(uv_async_t *handle) {
+static bool PrinterEventPoll(void *arg) {
+    GNFingerprinter::EventContext *context = reinterpret_cast<GNFingerprinter::EventContext *>(arg);
+    return groove_fingerprinter_info_peek(context->printer, 0) > 0;
+}
+
+static void PrinterEventFlush(void *arg) {
     Nan::HandleScope scope;
 
-    GNFingerprinter::EventContext *context = reinterpret_cast<GNFingerprinter::EventContext *>(handle->data);
+    GNFingerprinter::EventContext *context = reinterpret_cast<GNFingerprinter::EventContext *>(arg);
 
     // call callback signaling that there is info ready
 
@@ -153,53 +172,47 @@ static void PrinterEventAsyncCb(uv_async_t *handle) {
     if (try_catch.HasCaught()) {
         node::FatalException(try_catch);
     }
-
-    uv_mutex_lock(&context->mutex);
-    uv_cond_signal(&context->cond);
-    uv_mutex_unlock(&context->mutex);
-}
-
-static void PrinterEventThreadEntry(void *arg) {
-    GNFingerprinter::EventContext *context = reinterpret_cast<GNFingerprinter::EventContext *>(arg);
-    while (groove_fingerprinter_info_peek(context->printer, 1) > 0) {
-        uv_mutex_lock(&context->mutex);
-        uv_async_send(&context->event_async);
-        uv_cond_wait(&context->cond, &context->mutex);
-        uv_mutex_unlock(&context->mutex);
-    }
 }
 
 class PrinterAttachWorker : public Nan::AsyncWorker {
 public:
     PrinterAttachWorker(Nan::Callback *callback, GrooveFingerprinter *printer, GroovePlaylist *playlist,
-            GNFingerprinter::EventContext *event_context) :
+            GNFingerprinter::EventContext *event_context, GNCancelState *cancel) :
         Nan::AsyncWorker(callback)
     {
         this->printer = printer;
         this->playlist = playlist;
         this->event_context = event_context;
+        this->cancel = cancel;
+    }
+    ~PrinterAttachWorker() {
+        cancel_state_unref(cancel);
     }
-    ~PrinterAttachWorker() {}
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         int err;
         if ((err = groove_fingerprinter_attach(printer, playlist))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
 
-        uv_cond_init(&event_context->cond);
-        uv_mutex_init(&event_context->mutex);
-
-        event_context->event_async.data = event_context;
-        uv_async_init(uv_default_loop(), &event_context->event_async, PrinterEventAsyncCb);
+        position_view_attach(event_context->position_view, playlist);
+    }
 
-        uv_thread_create(&event_context->event_thread, PrinterEventThreadEntry, event_context);
+    void HandleOKCallback() {
+        event_context->event_source = event_dispatcher_add(PrinterEventPoll,
+                PrinterEventFlush, event_context);
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GrooveFingerprinter *printer;
     GroovePlaylist *playlist;
     GNFingerprinter::EventContext *event_context;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNFingerprinter::Attach) {
@@ -213,11 +226,11 @@ NAN_METHOD(GNFingerprinter::Attach) {
     }
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info[0]->ToObject());
 
-    if (info.Length() < 2 || !info[1]->IsFunction()) {
-        Nan::ThrowTypeError("Expected function arg[1]");
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
         return;
-    }
-    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
 
     Local<Object> instance = info.This();
     GrooveFingerprinter *printer = gn_printer->printer;
@@ -225,7 +238,7 @@ NAN_METHOD(GNFingerprinter::Attach) {
     // copy the properties from our instance to the player
     printer->info_queue_size = (int)instance->Get(Nan::New<String>("infoQueueSize").ToLocalChecked())->NumberValue();
 
-    AsyncQueueWorker(new PrinterAttachWorker(callback, printer, gn_playlist->playlist, gn_printer->event_context));
+    scheduler_queue(new PrinterAttachWorker(callback, printer, gn_playlist->playlist, gn_printer->event_context, cancel), GNPriorityInteractive);
 }
 
 class PrinterDetachWorker : public Nan::AsyncWorker {
@@ -241,15 +254,11 @@ public:
 
     void Execute() {
         int err;
+        position_view_detach(event_context->position_view);
         if ((err = groove_fingerprinter_detach(printer))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
-        uv_cond_signal(&event_context->cond);
-        uv_thread_join(&event_context->event_thread);
-        uv_cond_destroy(&event_context->cond);
-        uv_mutex_destroy(&event_context->mutex);
-        uv_close(reinterpret_cast<uv_handle_t*>(&event_context->event_async), NULL);
     }
 
     GrooveFingerprinter *printer;
@@ -266,7 +275,13 @@ NAN_METHOD(GNFingerprinter::Detach) {
     }
     Nan::Callback *callback = new Nan::Callback(info[0].As<Function>());
 
-    AsyncQueueWorker(new PrinterDetachWorker(callback, gn_printer->printer, gn_printer->event_context));
+    // stop delivering events now rather than when the detach finishes
+    if (gn_printer->event_context->event_source) {
+        event_dispatcher_remove(gn_printer->event_context->event_source);
+        gn_printer->event_context->event_source = NULL;
+    }
+
+    scheduler_queue(new PrinterDetachWorker(callback, gn_printer->printer, gn_printer->event_context), GNPriorityInteractive);
 }
 
 NAN_METHOD(GNFingerprinter::Encode) {
@@ -316,3 +331,9 @@ NAN_METHOD(GNFingerprinter::Decode) {
 
     info.GetReturnValue().Set(int_list);
 }
+
+NAN_METHOD(GNFingerprinter::PositionView) {
+    Nan::HandleScope scope;
+    GNFingerprinter *gn_printer = node::ObjectWrap::Unwrap<GNFingerprinter>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_printer->event_context->position_view));
+}
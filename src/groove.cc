@@ -3,22 +3,87 @@
 #include <cstdlib>
 #include "groove.h"
 #include "file.h"
+#include "file_pool.h"
 #include "player.h"
 #include "playlist.h"
 #include "playlist_item.h"
 #include "loudness_detector.h"
 #include "fingerprinter.h"
 #include "waveform_builder.h"
+#include "null_sink.h"
 #include "encoder.h"
 #include "device.h"
+#include "stream_writer.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "device_watcher.h"
+#include "env.h"
 
 using namespace v8;
 
+// One libgroove and libsoundio context is shared by every environment which
+// loads the module. Each is created the first time it is needed and both are
+// destroyed when the last environment shuts down. The mutex also serializes
+// backend and device calls, which libsoundio expects to come from a single
+// thread.
+static uv_once_t context_once = UV_ONCE_INIT;
+static uv_mutex_t context_mutex;
+// held while connecting or disconnecting a backend, which includes starting
+// and stopping the device watcher
+static uv_mutex_t backend_mutex;
+static int context_ref_count = 0;
 static SoundIo *soundio = NULL;
 static Groove *groove = NULL;
 
+// cleared by groove.init({audio: false})
+static thread_local bool audio_enabled = true;
+
 Groove *get_groove() {
-    return groove;
+    uv_mutex_lock(&context_mutex);
+    if (!groove) {
+        int err;
+        if ((err = groove_create(&groove))) {
+            fprintf(stderr, "unable to initialize libgroove: %s\n", groove_strerror(err));
+            abort();
+        }
+    }
+    Groove *result = groove;
+    uv_mutex_unlock(&context_mutex);
+    return result;
+}
+
+// call with context_mutex held
+static SoundIo *get_soundio_locked() {
+    if (!audio_enabled)
+        return NULL;
+    if (!soundio) {
+        soundio = soundio_create();
+        if (!soundio) {
+            fprintf(stderr, "unable to initialize libsoundio: out of memory\n");
+            abort();
+        }
+    }
+    return soundio;
+}
+
+SoundIo *get_soundio() {
+    uv_mutex_lock(&context_mutex);
+    SoundIo *result = get_soundio_locked();
+    uv_mutex_unlock(&context_mutex);
+    return result;
+}
+
+NAN_METHOD(Init) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    Local<Value> audio_value = Nan::Get(info[0]->ToObject(),
+            Nan::New<String>("audio").ToLocalChecked()).ToLocalChecked();
+    if (!audio_value->IsUndefined())
+        audio_enabled = audio_value->BooleanValue();
 }
 
 NAN_METHOD(SetLogging) {
@@ -31,6 +96,23 @@ NAN_METHOD(SetLogging) {
     groove_set_logging(info[0]->NumberValue());
 }
 
+NAN_METHOD(SetSchedulerThreadCount) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsNumber()) {
+        Nan::ThrowTypeError("Expected number arg[0]");
+        return;
+    }
+    int err = scheduler_set_thread_count((int)info[0]->NumberValue());
+    if (err == UV_EBUSY) {
+        Nan::ThrowError("scheduler already started");
+        return;
+    } else if (err) {
+        Nan::ThrowError("Expected thread count to be at least 1");
+        return;
+    }
+}
+
 NAN_METHOD(ConnectSoundBackend) {
     SoundIoBackend backend = SoundIoBackendNone;
     if (info.Length() == 1) {
@@ -44,11 +126,26 @@ NAN_METHOD(ConnectSoundBackend) {
         return;
     }
 
+    SoundIo *soundio = get_soundio();
+    if (!soundio) {
+        Nan::ThrowError("audio is disabled");
+        return;
+    }
+
+    uv_mutex_lock(&backend_mutex);
+    device_watcher_stop();
+
+    uv_mutex_lock(&context_mutex);
     if (soundio->current_backend != SoundIoBackendNone)
         soundio_disconnect(soundio);
 
     int err = (backend == SoundIoBackendNone) ?
         soundio_connect(soundio) : soundio_connect_backend(soundio, backend);
+    uv_mutex_unlock(&context_mutex);
+
+    if (!err)
+        device_watcher_start(soundio);
+    uv_mutex_unlock(&backend_mutex);
 
     if (err) {
         Nan::ThrowError(soundio_strerror(err));
@@ -57,37 +154,138 @@ NAN_METHOD(ConnectSoundBackend) {
 }
 
 NAN_METHOD(DisconnectSoundBackend) {
-    if (soundio->current_backend != SoundIoBackendNone)
+    uv_mutex_lock(&backend_mutex);
+    device_watcher_stop();
+
+    uv_mutex_lock(&context_mutex);
+    // nothing to disconnect if no backend was ever connected
+    if (soundio && soundio->current_backend != SoundIoBackendNone)
         soundio_disconnect(soundio);
+    uv_mutex_unlock(&context_mutex);
+    uv_mutex_unlock(&backend_mutex);
 }
 
-NAN_METHOD(GetDevices) {
-    Nan::HandleScope scope;
+// The device list of each environment is built from the watcher's snapshot
+// and kept until the snapshot changes.
+static GNEnvPersistent<Object> cached_devices;
+static thread_local uint32_t cached_devices_version = 0;
+static GNEnvPersistent<Function> devices_changed_cb;
+static thread_local uv_async_t *devices_changed_async = NULL;
 
-    if (soundio->current_backend == SoundIoBackendNone) {
-        Nan::ThrowError("no backend connected");
-        return;
-    }
+static void freeze(Local<Object> object) {
+    object->SetIntegrityLevel(Nan::GetCurrentContext(), IntegrityLevel::kFrozen).FromJust();
+}
+
+// Returns an empty handle if no backend is connected. The list is frozen,
+// since every caller gets the same object.
+static Local<Object> get_device_list() {
+    Nan::EscapableHandleScope scope;
 
-    soundio_flush_events(soundio);
+    if (cached_devices_version != 0 && cached_devices_version == device_watcher_version())
+        return scope.Escape(cached_devices.Get());
 
-    int output_count = soundio_output_device_count(soundio);
-    int default_output = soundio_default_output_device_index(soundio);
+    std::vector<SoundIoDevice *> devices;
+    int default_output;
+    uint32_t version;
+    if (!device_watcher_snapshot(&devices, &default_output, &version))
+        return Local<Object>();
 
     Local<Array> deviceList = Nan::New<Array>();
 
-    for (int i = 0; i < output_count; i += 1) {
-        struct SoundIoDevice *device = soundio_get_output_device(soundio, i);
-        Local<Value> deviceObject = GNDevice::NewInstance(device);
+    for (size_t i = 0; i < devices.size(); i += 1) {
+        // takes over the snapshot's reference
+        Local<Value> deviceObject = GNDevice::NewInstance(devices[i]);
+        freeze(deviceObject->ToObject());
         Nan::Set(deviceList, Nan::New<Number>(i), deviceObject);
     }
+    freeze(deviceList);
 
     Local<Object> ret_value = Nan::New<Object>();
 
     Nan::Set(ret_value, Nan::New<String>("list").ToLocalChecked(), deviceList);
     Nan::Set(ret_value, Nan::New<String>("defaultIndex").ToLocalChecked(), Nan::New<Number>(default_output));
+    freeze(ret_value);
+
+    cached_devices.Reset(ret_value);
+    cached_devices_version = version;
+    return scope.Escape(ret_value);
+}
 
-    info.GetReturnValue().Set(ret_value);
+NAN_METHOD(GetDevices) {
+    Nan::HandleScope scope;
+
+    if (!get_soundio()) {
+        Nan::ThrowError("audio is disabled");
+        return;
+    }
+
+    Local<Object> devices = get_device_list();
+    if (devices.IsEmpty()) {
+        Nan::ThrowError("no backend connected");
+        return;
+    }
+
+    info.GetReturnValue().Set(devices);
+}
+
+static void DevicesChangedAsyncCb(uv_async_t *handle) {
+    Nan::HandleScope scope;
+
+    if (cached_devices_version == device_watcher_version())
+        return;
+
+    Local<Value> old_devices = Nan::Null();
+    if (cached_devices_version != 0)
+        old_devices = cached_devices.Get();
+
+    Local<Value> new_devices = Nan::Null();
+    Local<Object> device_list = get_device_list();
+    if (!device_list.IsEmpty()) {
+        new_devices = device_list;
+    } else {
+        cached_devices_version = 0;
+    }
+
+    const unsigned argc = 2;
+    Local<Value> argv[argc] = {old_devices, new_devices};
+    TryCatch try_catch;
+    Nan::Callback callback(devices_changed_cb.Get());
+    callback.Call(argc, argv);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+}
+
+static void free_devices_changed_async(uv_handle_t *handle) {
+    delete reinterpret_cast<uv_async_t *>(handle);
+}
+
+static void close_devices_changed_async(void *arg) {
+    device_watcher_unlisten(devices_changed_async);
+    uv_close(reinterpret_cast<uv_handle_t*>(devices_changed_async), free_devices_changed_async);
+    devices_changed_async = NULL;
+}
+
+// Used by lib/index.js to emit 'devicesChanged' with the device lists from
+// before and after the change.
+NAN_METHOD(SetDevicesChangedCallback) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[0]");
+        return;
+    }
+    devices_changed_cb.Reset(info[0].As<Function>());
+
+    if (!devices_changed_async) {
+        devices_changed_async = new uv_async_t;
+        uv_async_init(env_loop(), devices_changed_async, DevicesChangedAsyncCb);
+        // watching for devices should not keep the process alive
+        uv_unref(reinterpret_cast<uv_handle_t*>(devices_changed_async));
+        device_watcher_listen(devices_changed_async);
+        env_at_exit(close_devices_changed_async, NULL);
+    }
 }
 
 NAN_METHOD(GetVersion) {
@@ -112,27 +310,58 @@ static void SetMethod(target_t obj, const char* name, FNPTR fn) {
             Nan::GetFunction(Nan::New<FunctionTemplate>(fn)).ToLocalChecked());
 }
 
-static void cleanup(void) {
-    groove_destroy(groove);
-    soundio_destroy(soundio);
+static void init_context_mutex(void) {
+    uv_mutex_init(&context_mutex);
+    uv_mutex_init(&backend_mutex);
 }
 
-NAN_MODULE_INIT(Initialize) {
-    int err;
+static void destroy_context(void) {
+    device_watcher_stop();
+    if (groove)
+        groove_destroy(groove);
+    if (soundio)
+        soundio_destroy(soundio);
+    groove = NULL;
+    soundio = NULL;
+}
 
-    soundio = soundio_create();
-    if (!soundio) {
-        fprintf(stderr, "unable to initialize libsoundio: out of memory\n");
-        abort();
+static void context_unref(void *arg) {
+    uv_mutex_lock(&context_mutex);
+    context_ref_count -= 1;
+    if (context_ref_count == 0)
+        destroy_context();
+    uv_mutex_unlock(&context_mutex);
+}
+
+static void cleanup(void) {
+    // only does anything when the process exits without tearing down the
+    // environments which still hold the context
+    uv_mutex_lock(&context_mutex);
+    if (context_ref_count > 0) {
+        context_ref_count = 0;
+        destroy_context();
     }
+    uv_mutex_unlock(&context_mutex);
+}
 
-    if ((err = groove_create(&groove))) {
-        fprintf(stderr, "unable to initialize libgroove: %s\n", groove_strerror(err));
-        abort();
+static void context_ref(void) {
+    uv_once(&context_once, init_context_mutex);
+    uv_mutex_lock(&context_mutex);
+    context_ref_count += 1;
+    static bool registered_atexit = false;
+    if (!registered_atexit) {
+        atexit(cleanup);
+        registered_atexit = true;
     }
-    atexit(cleanup);
+    uv_mutex_unlock(&context_mutex);
+}
+
+NAN_MODULE_INIT(Initialize) {
+    context_ref();
+    env_at_exit(context_unref, NULL);
 
     GNFile::Init();
+    GNFilePool::Init();
     GNPlayer::Init();
     GNPlaylist::Init();
     GNPlaylistItem::Init();
@@ -141,6 +370,9 @@ NAN_MODULE_INIT(Initialize) {
     GNFingerprinter::Init();
     GNDevice::Init();
     GNWaveformBuilder::Init();
+    GNNullSink::Init();
+    GNStreamWriter::Init();
+    GNCancelToken::Init();
 
     SetProperty(target, "LOG_QUIET", GROOVE_LOG_QUIET);
     SetProperty(target, "LOG_ERROR", GROOVE_LOG_ERROR);
@@ -169,21 +401,35 @@ NAN_MODULE_INIT(Initialize) {
     SetProperty(target, "BACKEND_WASAPI", SoundIoBackendWasapi);
     SetProperty(target, "BACKEND_DUMMY", SoundIoBackendDummy);
 
+    SetMethod(target, "init", Init);
     SetMethod(target, "setLogging", SetLogging);
+    SetMethod(target, "setSchedulerThreadCount", SetSchedulerThreadCount);
     SetMethod(target, "getDevices", GetDevices);
+    SetMethod(target, "_setDevicesChangedCallback", SetDevicesChangedCallback);
     SetMethod(target, "connectSoundBackend", ConnectSoundBackend);
     SetMethod(target, "disconnectSoundBackend", DisconnectSoundBackend);
     SetMethod(target, "getVersion", GetVersion);
     SetMethod(target, "open", GNFile::Open);
+    SetMethod(target, "openBuffer", GNFile::OpenBuffer);
+    SetMethod(target, "openMapped", GNFile::OpenMapped);
+    SetMethod(target, "openStream", GNFile::OpenStream);
+    SetMethod(target, "scan", GNFile::Scan);
+    SetMethod(target, "writeTags", GNFile::WriteTags);
+    SetMethod(target, "openMetadataCache", GNFile::OpenMetadataCache);
+    SetMethod(target, "saveMetadataCache", GNFile::SaveMetadataCache);
+    SetMethod(target, "closeMetadataCache", GNFile::CloseMetadataCache);
+    SetMethod(target, "createFilePool", GNFilePool::Create);
+    SetMethod(target, "createCancelToken", GNCancelToken::Create);
     SetMethod(target, "createPlayer", GNPlayer::Create);
     SetMethod(target, "createPlaylist", GNPlaylist::Create);
     SetMethod(target, "createLoudnessDetector", GNLoudnessDetector::Create);
     SetMethod(target, "createEncoder", GNEncoder::Create);
     SetMethod(target, "createFingerprinter", GNFingerprinter::Create);
     SetMethod(target, "createWaveformBuilder", GNWaveformBuilder::Create);
+    SetMethod(target, "createNullSink", GNNullSink::Create);
 
     SetMethod(target, "encodeFingerprint", GNFingerprinter::Encode);
     SetMethod(target, "decodeFingerprint", GNFingerprinter::Decode);
 }
 
-NODE_MODULE(groove, Initialize)
+NAN_MODULE_WORKER_ENABLED(groove, Initialize)
@@ -3,6 +3,9 @@
 
 #include <groove/groove.h>
 
+// Both are created on first use. get_soundio returns NULL when audio was
+// disabled with groove.init({audio: false}).
 Groove *get_groove();
+SoundIo *get_soundio();
 
 #endif
@@ -1,18 +1,29 @@
 #include "loudness_detector.h"
+#include "env.h"
 #include "playlist_item.h"
 #include "playlist.h"
 #include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
 
 using namespace v8;
 
 GNLoudnessDetector::GNLoudnessDetector() {};
 GNLoudnessDetector::~GNLoudnessDetector() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    position_view_destroy(event_context->position_view);
     groove_loudness_detector_destroy(detector);
     delete event_context->event_cb;
     delete event_context;
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *sink, GroovePlaylistItem **item, double *pos) {
+    groove_loudness_detector_position(reinterpret_cast<GrooveLoudnessDetector *>(sink), item, pos);
+}
 
 void GNLoudnessDetector::Init() {
     // Prepare constructor template
@@ -25,6 +36,7 @@ void GNLoudnessDetector::Init() {
     Nan::SetPrototypeMethod(tpl, "detach", Detach);
     Nan::SetPrototypeMethod(tpl, "getInfo", GetInfo);
     Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -41,7 +53,7 @@ NAN_METHOD(GNLoudnessDetector::New) {
 Local<Value> GNLoudnessDetector::NewInstance(GrooveLoudnessDetector *detector) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNLoudnessDetector *gn_detector = node::ObjectWrap::Unwrap<GNLoudnessDetector>(instance);
@@ -72,6 +84,8 @@ NAN_METHOD(GNLoudnessDetector::Create) {
     gn_detector->event_context = context;
     context->event_cb = new Nan::Callback(info[0].As<Function>());
     context->detector = detector;
+    context->event_source = NULL;
+    context->position_view = position_view_create(detector, PositionFn);
 
     Nan::Set(instance, Nan::New<String>("infoQueueSize").ToLocalChecked(),
             Nan::New<Number>(detector->info_queue_size));
@@ -127,10 +141,15 @@ NAN_METHOD(GNLoudnessDetector::GetInfo) {
     }
 }
 
-static void EventAsyncCb(uv_async_t *handle) {
+static bool EventPoll(void *arg) {
+    GNLoudnessDetector::EventContext *context = reinterpret_cast<GNLoudnessDetector::EventContext *>(arg);
+    return groove_loudness_detector_info_peek(context->detector, 0) > 0;
+}
+
+static void EventFlush(void *arg) {
     Nan::HandleScope scope;
 
-    GNLoudnessDetector::EventContext *context = reinterpret_cast<GNLoudnessDetector::EventContext *>(handle->data);
+    GNLoudnessDetector::EventContext *context = reinterpret_cast<GNLoudnessDetector::EventContext *>(arg);
 
     // call callback signaling that there is info ready
 
@@ -144,53 +163,46 @@ static void EventAsyncCb(uv_async_t *handle) {
     if (try_catch.HasCaught()) {
         node::FatalException(try_catch);
     }
-
-    uv_mutex_lock(&context->mutex);
-    uv_cond_signal(&context->cond);
-    uv_mutex_unlock(&context->mutex);
-}
-
-static void EventThreadEntry(void *arg) {
-    GNLoudnessDetector::EventContext *context = reinterpret_cast<GNLoudnessDetector::EventContext *>(arg);
-    while (groove_loudness_detector_info_peek(context->detector, 1) > 0) {
-        uv_mutex_lock(&context->mutex);
-        uv_async_send(&context->event_async);
-        uv_cond_wait(&context->cond, &context->mutex);
-        uv_mutex_unlock(&context->mutex);
-    }
 }
 
 class DetectorAttachWorker : public Nan::AsyncWorker {
 public:
     DetectorAttachWorker(Nan::Callback *callback, GrooveLoudnessDetector *detector, GroovePlaylist *playlist,
-            GNLoudnessDetector::EventContext *event_context) :
+            GNLoudnessDetector::EventContext *event_context, GNCancelState *cancel) :
         Nan::AsyncWorker(callback)
     {
         this->detector = detector;
         this->playlist = playlist;
         this->event_context = event_context;
+        this->cancel = cancel;
+    }
+    ~DetectorAttachWorker() {
+        cancel_state_unref(cancel);
     }
-    ~DetectorAttachWorker() {}
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         int err;
         if ((err = groove_loudness_detector_attach(detector, playlist))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
 
-        uv_cond_init(&event_context->cond);
-        uv_mutex_init(&event_context->mutex);
-
-        event_context->event_async.data = event_context;
-        uv_async_init(uv_default_loop(), &event_context->event_async, EventAsyncCb);
+        position_view_attach(event_context->position_view, playlist);
+    }
 
-        uv_thread_create(&event_context->event_thread, EventThreadEntry, event_context);
+    void HandleOKCallback() {
+        event_context->event_source = event_dispatcher_add(EventPoll, EventFlush, event_context);
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GrooveLoudnessDetector *detector;
     GroovePlaylist *playlist;
     GNLoudnessDetector::EventContext *event_context;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNLoudnessDetector::Attach) {
@@ -204,11 +216,11 @@ NAN_METHOD(GNLoudnessDetector::Attach) {
     }
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info[0]->ToObject());
 
-    if (info.Length() < 2 || !info[1]->IsFunction()) {
-        Nan::ThrowTypeError("Expected function arg[1]");
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
         return;
-    }
-    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
 
     Local<Object> instance = info.This();
 
@@ -218,7 +230,7 @@ NAN_METHOD(GNLoudnessDetector::Attach) {
     detector->info_queue_size = (int)instance->Get(Nan::New<String>("infoQueueSize").ToLocalChecked())->NumberValue();
     detector->disable_album = (int)instance->Get(Nan::New<String>("disableAlbum").ToLocalChecked())->BooleanValue();
 
-    AsyncQueueWorker(new DetectorAttachWorker(callback, detector, gn_playlist->playlist, gn_detector->event_context));
+    scheduler_queue(new DetectorAttachWorker(callback, detector, gn_playlist->playlist, gn_detector->event_context, cancel), GNPriorityInteractive);
 }
 
 class DetectorDetachWorker : public Nan::AsyncWorker {
@@ -234,15 +246,11 @@ public:
 
     void Execute() {
         int err;
+        position_view_detach(event_context->position_view);
         if ((err = groove_loudness_detector_detach(detector))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
-        uv_cond_signal(&event_context->cond);
-        uv_thread_join(&event_context->event_thread);
-        uv_cond_destroy(&event_context->cond);
-        uv_mutex_destroy(&event_context->mutex);
-        uv_close(reinterpret_cast<uv_handle_t*>(&event_context->event_async), NULL);
     }
 
     GrooveLoudnessDetector *detector;
@@ -260,5 +268,17 @@ NAN_METHOD(GNLoudnessDetector::Detach) {
     GNLoudnessDetector *gn_detector = node::ObjectWrap::Unwrap<GNLoudnessDetector>(info.This());
     GrooveLoudnessDetector *detector = gn_detector->detector;
 
-    AsyncQueueWorker(new DetectorDetachWorker(callback, detector, gn_detector->event_context));
+    // stop delivering events now rather than when the detach finishes
+    if (gn_detector->event_context->event_source) {
+        event_dispatcher_remove(gn_detector->event_context->event_source);
+        gn_detector->event_context->event_source = NULL;
+    }
+
+    scheduler_queue(new DetectorDetachWorker(callback, detector, gn_detector->event_context), GNPriorityInteractive);
+}
+
+NAN_METHOD(GNLoudnessDetector::PositionView) {
+    Nan::HandleScope scope;
+    GNLoudnessDetector *gn_detector = node::ObjectWrap::Unwrap<GNLoudnessDetector>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_detector->event_context->position_view));
 }
@@ -0,0 +1,392 @@
+#include <uv.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unordered_map>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+#include "metadata_cache.h"
+
+/* The cache file is a header followed by one record per file:
+ *
+ *   "GNMC" u32 version u32 record_count
+ *   u32 record_size, then record_size bytes of:
+ *     string path, i64 size, i64 mtime_ns, f64 duration, string short_names,
+ *     u32 tag_count, tag_count * (string key, string value)
+ *
+ * where a string is a u32 byte length followed by the bytes. Integers are in
+ * host byte order; the cache is not meant to be moved between machines.
+ *
+ * The file is mapped read-only and only the paths are indexed when it is
+ * opened. New entries are kept in memory until metadata_cache_save(), which
+ * writes a temporary file, flushes it to disk and renames it over the old
+ * one. A file whose records do not add up to record_count and end exactly
+ * at the end of the file is thrown away as a whole.
+ */
+
+static const char cache_magic[4] = {'G', 'N', 'M', 'C'};
+static const uint32_t cache_version = 2;
+
+struct CacheRecord {
+    GNCacheKey key;
+    GNFileInfo info;
+};
+
+struct Reader {
+    const char *ptr;
+    const char *end;
+};
+
+static uv_once_t cache_once = UV_ONCE_INIT;
+static uv_mutex_t cache_mutex;
+static bool cache_is_open = false;
+static std::string cache_filename;
+
+static char *map_base = NULL;
+static size_t map_size = 0;
+static bool map_is_mmap = false;
+static std::unordered_map<std::string, Reader> map_index;
+static std::unordered_map<std::string, CacheRecord> new_records;
+
+static void init_cache_mutex(void) {
+    uv_mutex_init(&cache_mutex);
+}
+
+static bool read_bytes(Reader *r, void *dest, size_t n) {
+    if ((size_t)(r->end - r->ptr) < n)
+        return false;
+    memcpy(dest, r->ptr, n);
+    r->ptr += n;
+    return true;
+}
+
+static bool read_u32(Reader *r, uint32_t *x) {
+    return read_bytes(r, x, sizeof(uint32_t));
+}
+
+static bool read_string(Reader *r, std::string *s) {
+    uint32_t len;
+    if (!read_u32(r, &len) || (size_t)(r->end - r->ptr) < len)
+        return false;
+    s->assign(r->ptr, len);
+    r->ptr += len;
+    return true;
+}
+
+static bool read_record(Reader *r, CacheRecord *record) {
+    uint32_t tag_count;
+    if (!read_bytes(r, &record->key.size, sizeof(int64_t)) ||
+        !read_bytes(r, &record->key.mtime_ns, sizeof(int64_t)) ||
+        !read_bytes(r, &record->info.duration, sizeof(double)) ||
+        !read_string(r, &record->info.short_names) ||
+        !read_u32(r, &tag_count))
+    {
+        return false;
+    }
+    record->info.tags.clear();
+    for (uint32_t i = 0; i < tag_count; i += 1) {
+        std::string key, value;
+        if (!read_string(r, &key) || !read_string(r, &value))
+            return false;
+        record->info.tags.push_back(std::make_pair(key, value));
+    }
+    return true;
+}
+
+static void write_bytes(std::string *out, const void *src, size_t n) {
+    out->append(reinterpret_cast<const char *>(src), n);
+}
+
+static void write_u32(std::string *out, uint32_t x) {
+    write_bytes(out, &x, sizeof(uint32_t));
+}
+
+static void write_string(std::string *out, const std::string &s) {
+    write_u32(out, (uint32_t)s.size());
+    out->append(s);
+}
+
+static void write_record(std::string *out, const std::string &path, const CacheRecord &record) {
+    std::string payload;
+    write_string(&payload, path);
+    write_bytes(&payload, &record.key.size, sizeof(int64_t));
+    write_bytes(&payload, &record.key.mtime_ns, sizeof(int64_t));
+    write_bytes(&payload, &record.info.duration, sizeof(double));
+    write_string(&payload, record.info.short_names);
+    write_u32(&payload, (uint32_t)record.info.tags.size());
+    for (size_t i = 0; i < record.info.tags.size(); i += 1) {
+        write_string(&payload, record.info.tags[i].first);
+        write_string(&payload, record.info.tags[i].second);
+    }
+    write_u32(out, (uint32_t)payload.size());
+    out->append(payload);
+}
+
+static void unmap_file(void) {
+    map_index.clear();
+    if (!map_base)
+        return;
+#ifndef _WIN32
+    if (map_is_mmap) {
+        munmap(map_base, map_size);
+    } else {
+        free(map_base);
+    }
+#else
+    free(map_base);
+#endif
+    map_base = NULL;
+    map_size = 0;
+    map_is_mmap = false;
+}
+
+static int map_file(const char *filename) {
+#ifndef _WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+        return (errno == ENOENT) ? 0 : -errno;
+    struct stat st;
+    if (fstat(fd, &st)) {
+        int err = -errno;
+        close(fd);
+        return err;
+    }
+    map_size = st.st_size;
+    if (map_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void *base = mmap(NULL, map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        map_size = 0;
+        return -errno;
+    }
+    map_base = reinterpret_cast<char *>(base);
+    map_is_mmap = true;
+#else
+    FILE *f = fopen(filename, "rb");
+    if (!f)
+        return 0;
+    fseek(f, 0, SEEK_END);
+    long len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len <= 0) {
+        fclose(f);
+        return 0;
+    }
+    map_base = reinterpret_cast<char *>(malloc(len));
+    if (!map_base) {
+        fclose(f);
+        return UV_ENOMEM;
+    }
+    map_size = fread(map_base, 1, len, f);
+    fclose(f);
+#endif
+
+    Reader r = {map_base, map_base + map_size};
+    char magic[4];
+    uint32_t version;
+    uint32_t record_count;
+    if (!read_bytes(&r, magic, sizeof(magic)) || memcmp(magic, cache_magic, sizeof(magic)) ||
+        !read_u32(&r, &version) || version != cache_version || !read_u32(&r, &record_count))
+    {
+        // unrecognized cache; start over
+        unmap_file();
+        return 0;
+    }
+
+    uint32_t loaded = 0;
+    while (loaded < record_count) {
+        uint32_t record_size;
+        if (!read_u32(&r, &record_size) || (size_t)(r.end - r.ptr) < record_size)
+            break;
+        Reader record = {r.ptr, r.ptr + record_size};
+        r.ptr += record_size;
+        Reader path_reader = record;
+        std::string path;
+        if (!read_string(&path_reader, &path))
+            break;
+        map_index[path] = record;
+        loaded += 1;
+    }
+    if (loaded != record_count || r.ptr != r.end) {
+        // truncated or damaged, for example by a crash during a save
+        unmap_file();
+    }
+    return 0;
+}
+
+// Flushes path, which may be a directory, to disk.
+static int sync_path(const char *path) {
+#ifndef _WIN32
+    int fd = open(path, O_RDONLY);
+    if (fd == -1)
+        return -errno;
+    int err = fsync(fd) ? -errno : 0;
+    close(fd);
+    return err;
+#else
+    return 0;
+#endif
+}
+
+int metadata_cache_open(const char *filename) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    unmap_file();
+    new_records.clear();
+    int err = map_file(filename);
+    cache_is_open = (err == 0);
+    cache_filename = filename;
+    uv_mutex_unlock(&cache_mutex);
+    return err;
+}
+
+void metadata_cache_close(void) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    unmap_file();
+    new_records.clear();
+    cache_is_open = false;
+    uv_mutex_unlock(&cache_mutex);
+}
+
+bool metadata_cache_is_open(void) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    bool is_open = cache_is_open;
+    uv_mutex_unlock(&cache_mutex);
+    return is_open;
+}
+
+int metadata_cache_save(void) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    if (!cache_is_open) {
+        uv_mutex_unlock(&cache_mutex);
+        return UV_EINVAL;
+    }
+
+    std::string tmp_filename = cache_filename + ".tmp";
+    FILE *f = fopen(tmp_filename.c_str(), "wb");
+    if (!f) {
+        uv_mutex_unlock(&cache_mutex);
+        return UV_EIO;
+    }
+
+    std::string out;
+    write_bytes(&out, cache_magic, sizeof(cache_magic));
+    write_u32(&out, cache_version);
+    size_t record_count_offset = out.size();
+    write_u32(&out, 0);
+    uint32_t record_count = 0;
+
+    // copy over the records that did not change without parsing them
+    std::unordered_map<std::string, Reader>::iterator it;
+    for (it = map_index.begin(); it != map_index.end(); ++it) {
+        if (new_records.count(it->first))
+            continue;
+        const Reader &record = it->second;
+        size_t record_size = record.end - record.ptr;
+        write_u32(&out, (uint32_t)record_size);
+        out.append(record.ptr, record_size);
+        record_count += 1;
+    }
+    std::unordered_map<std::string, CacheRecord>::iterator new_it;
+    for (new_it = new_records.begin(); new_it != new_records.end(); ++new_it) {
+        write_record(&out, new_it->first, new_it->second);
+        record_count += 1;
+    }
+    memcpy(&out[record_count_offset], &record_count, sizeof(uint32_t));
+
+    bool ok = (fwrite(out.data(), 1, out.size(), f) == out.size());
+    ok = (fflush(f) == 0) && ok;
+    ok = (fclose(f) == 0) && ok;
+    // the data has to be on disk before the rename, or a crash could leave
+    // an empty file under the cache's name
+    ok = ok && (sync_path(tmp_filename.c_str()) == 0);
+    if (!ok) {
+        remove(tmp_filename.c_str());
+        uv_mutex_unlock(&cache_mutex);
+        return UV_EIO;
+    }
+
+    unmap_file();
+    uv_fs_t req;
+    int err = uv_fs_rename(uv_default_loop(), &req, tmp_filename.c_str(), cache_filename.c_str(), NULL);
+    uv_fs_req_cleanup(&req);
+    if (err == 0) {
+        new_records.clear();
+        std::string dir(cache_filename);
+        size_t slash = dir.rfind('/');
+        dir = (slash == std::string::npos) ? "." : dir.substr(0, slash + 1);
+        err = sync_path(dir.c_str());
+    }
+    int map_err = map_file(cache_filename.c_str());
+    uv_mutex_unlock(&cache_mutex);
+    return err ? err : map_err;
+}
+
+int metadata_cache_stat(const char *filename, GNCacheKey *key) {
+    uv_fs_t req;
+    int err = uv_fs_stat(uv_default_loop(), &req, filename, NULL);
+    if (err == 0) {
+        key->size = req.statbuf.st_size;
+        key->mtime_ns = (int64_t)req.statbuf.st_mtim.tv_sec * 1000000000LL + req.statbuf.st_mtim.tv_nsec;
+    }
+    uv_fs_req_cleanup(&req);
+    return err;
+}
+
+bool metadata_cache_get(const char *filename, const GNCacheKey *key, GNFileInfo *info) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    if (!cache_is_open) {
+        uv_mutex_unlock(&cache_mutex);
+        return false;
+    }
+
+    CacheRecord record;
+    bool found = false;
+    std::unordered_map<std::string, CacheRecord>::iterator new_it = new_records.find(filename);
+    if (new_it != new_records.end()) {
+        record = new_it->second;
+        found = true;
+    } else {
+        std::unordered_map<std::string, Reader>::iterator it = map_index.find(filename);
+        if (it != map_index.end()) {
+            Reader r = it->second;
+            std::string path;
+            found = read_string(&r, &path) && read_record(&r, &record);
+        }
+    }
+    uv_mutex_unlock(&cache_mutex);
+
+    if (!found || record.key.size != key->size || record.key.mtime_ns != key->mtime_ns)
+        return false;
+
+    info->filename = filename;
+    info->duration = record.info.duration;
+    info->short_names.swap(record.info.short_names);
+    info->tags.swap(record.info.tags);
+    return true;
+}
+
+void metadata_cache_put(const char *filename, const GNCacheKey *key, const GNFileInfo *info) {
+    uv_once(&cache_once, init_cache_mutex);
+    uv_mutex_lock(&cache_mutex);
+    if (cache_is_open) {
+        CacheRecord &record = new_records[filename];
+        record.key = *key;
+        record.info.duration = info->duration;
+        record.info.short_names = info->short_names;
+        record.info.tags = info->tags;
+    }
+    uv_mutex_unlock(&cache_mutex);
+}
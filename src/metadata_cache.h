@@ -0,0 +1,33 @@
+#ifndef GN_METADATA_CACHE_H
+#define GN_METADATA_CACHE_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct GNFileInfo {
+    std::string filename;
+    double duration;
+    std::string short_names;
+    std::vector<std::pair<std::string, std::string> > tags;
+};
+
+// identifies one version of a file on disk
+struct GNCacheKey {
+    int64_t size;
+    int64_t mtime_ns;
+};
+
+// These return 0 on success or a negative libuv error code.
+int metadata_cache_open(const char *filename);
+int metadata_cache_save(void);
+void metadata_cache_close(void);
+bool metadata_cache_is_open(void);
+
+int metadata_cache_stat(const char *filename, GNCacheKey *key);
+
+// returns true if there is an entry for filename matching key
+bool metadata_cache_get(const char *filename, const GNCacheKey *key, GNFileInfo *info);
+void metadata_cache_put(const char *filename, const GNCacheKey *key, const GNFileInfo *info);
+
+#endif
@@ -0,0 +1,459 @@
+#include <string.h>
+#include "null_sink.h"
+#include "env.h"
+#include "playlist_item.h"
+#include "playlist.h"
+#include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
+
+using namespace v8;
+
+static void StopThread(GNNullSink::EventContext *context) {
+    uv_mutex_lock(&context->mutex);
+    context->abort_request = true;
+    uv_cond_signal(&context->cond);
+    uv_mutex_unlock(&context->mutex);
+
+    // wakes the thread if it is blocked waiting for a buffer
+    groove_sink_detach(context->sink);
+    uv_thread_join(&context->thread);
+
+    uv_mutex_lock(&context->mutex);
+    context->running = false;
+    context->detach_time = uv_hrtime();
+    context->item = NULL;
+    context->pos = -1.0;
+    uv_mutex_unlock(&context->mutex);
+}
+
+GNNullSink::GNNullSink() {};
+GNNullSink::~GNNullSink() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    if (event_context->running)
+        StopThread(event_context);
+    position_view_destroy(event_context->position_view);
+    groove_sink_destroy(sink);
+    uv_cond_destroy(&event_context->cond);
+    uv_mutex_destroy(&event_context->mutex);
+    delete event_context->event_cb;
+    delete event_context;
+};
+
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *arg, GroovePlaylistItem **item, double *pos) {
+    GNNullSink::EventContext *context = reinterpret_cast<GNNullSink::EventContext *>(arg);
+    uv_mutex_lock(&context->mutex);
+    *item = context->item;
+    *pos = context->pos;
+    uv_mutex_unlock(&context->mutex);
+}
+
+void GNNullSink::Init() {
+    // Prepare constructor template
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(Nan::New<String>("GrooveNullSink").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Methods
+    Nan::SetPrototypeMethod(tpl, "attach", Attach);
+    Nan::SetPrototypeMethod(tpl, "detach", Detach);
+    Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
+    Nan::SetPrototypeMethod(tpl, "stats", GetStats);
+
+    constructor.Reset(tpl->GetFunction());
+}
+
+NAN_METHOD(GNNullSink::New) {
+    Nan::HandleScope scope;
+
+    GNNullSink *obj = new GNNullSink();
+    obj->Wrap(info.This());
+
+    info.GetReturnValue().Set(info.This());
+}
+
+Local<Value> GNNullSink::NewInstance(GrooveSink *sink) {
+    Nan::EscapableHandleScope scope;
+
+    Local<Function> cons = constructor.Get();
+    Local<Object> instance = cons->NewInstance();
+
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(instance);
+    gn_sink->sink = sink;
+
+    return scope.Escape(instance);
+}
+
+NAN_METHOD(GNNullSink::Create) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[0]");
+        return;
+    }
+
+    GrooveSink *sink = groove_sink_create(get_groove());
+    if (!sink) {
+        Nan::ThrowTypeError("unable to create null sink");
+        return;
+    }
+
+    Local<Object> instance = GNNullSink::NewInstance(sink)->ToObject();
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(instance);
+    EventContext *context = new EventContext;
+    gn_sink->event_context = context;
+    context->event_cb = new Nan::Callback(info[0].As<Function>());
+    context->sink = sink;
+    context->event_source = NULL;
+    context->running = false;
+    context->real_time = true;
+    context->abort_request = false;
+    context->item = NULL;
+    context->pos = -1.0;
+    context->attach_time = 0;
+    context->detach_time = 0;
+    memset(&context->stats, 0, sizeof(Stats));
+    uv_mutex_init(&context->mutex);
+    uv_cond_init(&context->cond);
+    context->position_view = position_view_create(context, PositionFn);
+
+    Nan::Set(instance, Nan::New<String>("realTime").ToLocalChecked(), Nan::New<Boolean>(true));
+    Nan::Set(instance, Nan::New<String>("targetAudioFormat").ToLocalChecked(), Nan::Null());
+    Nan::Set(instance, Nan::New<String>("bufferSizeBytes").ToLocalChecked(),
+            Nan::New<Number>(sink->buffer_size_bytes));
+
+    info.GetReturnValue().Set(instance);
+}
+
+NAN_METHOD(GNNullSink::Position) {
+    Nan::HandleScope scope;
+
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(info.This());
+
+    GroovePlaylistItem *item;
+    double pos;
+    PositionFn(gn_sink->event_context, &item, &pos);
+
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, Nan::New<String>("pos").ToLocalChecked(), Nan::New<Number>(pos));
+    if (item) {
+        Nan::Set(obj, Nan::New<String>("item").ToLocalChecked(), GNPlaylistItem::NewInstance(item));
+    } else {
+        Nan::Set(obj, Nan::New<String>("item").ToLocalChecked(), Nan::Null());
+    }
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(GNNullSink::GetStats) {
+    Nan::HandleScope scope;
+
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(info.This());
+    EventContext *context = gn_sink->event_context;
+
+    uv_mutex_lock(&context->mutex);
+    Stats stats = context->stats;
+    uint64_t end_time = context->running ? uv_hrtime() : context->detach_time;
+    double elapsed = (end_time - context->attach_time) / 1000000000.0;
+    uv_mutex_unlock(&context->mutex);
+
+    double mean_lateness = (stats.buffer_count > 0) ?
+        stats.total_lateness_ns / 1000000000.0 / stats.buffer_count : 0.0;
+
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, Nan::New<String>("bufferCount").ToLocalChecked(), Nan::New<Number>(stats.buffer_count));
+    Nan::Set(obj, Nan::New<String>("frameCount").ToLocalChecked(), Nan::New<Number>(stats.frame_count));
+    Nan::Set(obj, Nan::New<String>("audioDuration").ToLocalChecked(), Nan::New<Number>(stats.audio_duration));
+    Nan::Set(obj, Nan::New<String>("elapsed").ToLocalChecked(), Nan::New<Number>(elapsed));
+    Nan::Set(obj, Nan::New<String>("underrunCount").ToLocalChecked(), Nan::New<Number>(stats.underrun_count));
+    Nan::Set(obj, Nan::New<String>("underrunDuration").ToLocalChecked(),
+            Nan::New<Number>(stats.underrun_ns / 1000000000.0));
+    Nan::Set(obj, Nan::New<String>("maxLateness").ToLocalChecked(),
+            Nan::New<Number>(stats.max_lateness_ns / 1000000000.0));
+    Nan::Set(obj, Nan::New<String>("meanLateness").ToLocalChecked(), Nan::New<Number>(mean_lateness));
+    info.GetReturnValue().Set(obj);
+}
+
+// Stands in for the device. In real time mode, each buffer is held for as
+// long as it would take to play, and if the next one is not ready by then
+// it counts as an underrun which lasts until it arrives.
+static void SinkThreadEntry(void *arg) {
+    GNNullSink::EventContext *context = reinterpret_cast<GNNullSink::EventContext *>(arg);
+    GrooveSink *sink = context->sink;
+    bool clock_running = false;
+    uint64_t clock_start = 0;
+    uint64_t played_ns = 0;
+
+    uv_mutex_lock(&context->mutex);
+    while (!context->abort_request) {
+        uv_mutex_unlock(&context->mutex);
+
+        GrooveBuffer *buffer;
+        int result = groove_sink_buffer_get(sink, &buffer, 0);
+        bool underrun = false;
+        uint64_t underrun_ns = 0;
+        if (result == GROOVE_BUFFER_NO) {
+            uint64_t start = uv_hrtime();
+            result = groove_sink_buffer_get(sink, &buffer, 1);
+            underrun = clock_running;
+            underrun_ns = uv_hrtime() - start;
+            clock_running = false;
+        }
+
+        uv_mutex_lock(&context->mutex);
+        if (context->abort_request) {
+            if (result == GROOVE_BUFFER_YES)
+                groove_buffer_unref(buffer);
+            break;
+        }
+        if (underrun && result != GROOVE_BUFFER_END) {
+            context->stats.underrun_count += 1;
+            context->stats.underrun_ns += underrun_ns;
+            context->events.push_back(GROOVE_EVENT_BUFFERUNDERRUN);
+        }
+        if (result == GROOVE_BUFFER_END) {
+            context->item = NULL;
+            context->pos = -1.0;
+            context->events.push_back(GROOVE_EVENT_END_OF_PLAYLIST);
+            clock_running = false;
+            continue;
+        } else if (result != GROOVE_BUFFER_YES) {
+            continue;
+        }
+
+        if (buffer->item != context->item)
+            context->events.push_back(GROOVE_EVENT_NOWPLAYING);
+        context->item = buffer->item;
+        context->pos = buffer->pos;
+
+        double duration = buffer->frame_count / (double)buffer->format.sample_rate;
+        context->stats.buffer_count += 1;
+        context->stats.frame_count += buffer->frame_count;
+        context->stats.audio_duration += duration;
+
+        if (context->real_time) {
+            uint64_t now = uv_hrtime();
+            if (clock_running) {
+                uint64_t due = clock_start + played_ns;
+                uint64_t lateness = (now > due) ? now - due : 0;
+                context->stats.total_lateness_ns += lateness;
+                if (lateness > context->stats.max_lateness_ns)
+                    context->stats.max_lateness_ns = lateness;
+            } else {
+                clock_start = now;
+                played_ns = 0;
+                clock_running = true;
+            }
+            played_ns += (uint64_t)(duration * 1000000000.0);
+            uint64_t deadline = clock_start + played_ns;
+            while (!context->abort_request && (now = uv_hrtime()) < deadline)
+                uv_cond_timedwait(&context->cond, &context->mutex, deadline - now);
+        }
+
+        groove_buffer_unref(buffer);
+    }
+    uv_mutex_unlock(&context->mutex);
+}
+
+static bool EventPoll(void *arg) {
+    GNNullSink::EventContext *context = reinterpret_cast<GNNullSink::EventContext *>(arg);
+    uv_mutex_lock(&context->mutex);
+    bool ready = !context->events.empty();
+    uv_mutex_unlock(&context->mutex);
+    return ready;
+}
+
+static void EventFlush(void *arg) {
+    Nan::HandleScope scope;
+
+    GNNullSink::EventContext *context = reinterpret_cast<GNNullSink::EventContext *>(arg);
+
+    std::vector<int> events;
+    uv_mutex_lock(&context->mutex);
+    events.swap(context->events);
+    uv_mutex_unlock(&context->mutex);
+
+    for (size_t i = 0; i < events.size(); i += 1) {
+        const unsigned argc = 1;
+        Local<Value> argv[argc];
+        argv[0] = Nan::New<Number>(events[i]);
+
+        TryCatch try_catch;
+        context->event_cb->Call(argc, argv);
+
+        if (try_catch.HasCaught()) {
+            node::FatalException(try_catch);
+        }
+        // detached by the handler
+        if (!context->event_source)
+            break;
+    }
+}
+
+class NullSinkAttachWorker : public Nan::AsyncWorker {
+public:
+    NullSinkAttachWorker(Nan::Callback *callback, GroovePlaylist *playlist,
+            GNNullSink::EventContext *event_context, GNCancelState *cancel) :
+        Nan::AsyncWorker(callback)
+    {
+        this->playlist = playlist;
+        this->event_context = event_context;
+        this->cancel = cancel;
+    }
+    ~NullSinkAttachWorker() {
+        cancel_state_unref(cancel);
+    }
+
+    void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
+        GNNullSink::EventContext *context = event_context;
+
+        uv_mutex_lock(&context->mutex);
+        context->abort_request = false;
+        context->item = NULL;
+        context->pos = -1.0;
+        context->events.clear();
+        memset(&context->stats, 0, sizeof(GNNullSink::Stats));
+        context->attach_time = uv_hrtime();
+        context->detach_time = context->attach_time;
+        uv_mutex_unlock(&context->mutex);
+
+        int err;
+        if ((err = groove_sink_attach(context->sink, playlist))) {
+            SetErrorMessage(groove_strerror(err));
+            return;
+        }
+
+        uv_mutex_lock(&context->mutex);
+        context->running = true;
+        uv_mutex_unlock(&context->mutex);
+        uv_thread_create(&context->thread, SinkThreadEntry, context);
+
+        position_view_attach(context->position_view, playlist);
+    }
+
+    void HandleOKCallback() {
+        event_context->event_source = event_dispatcher_add(EventPoll, EventFlush, event_context);
+        Nan::AsyncWorker::HandleOKCallback();
+    }
+
+    GroovePlaylist *playlist;
+    GNNullSink::EventContext *event_context;
+    GNCancelState *cancel;
+};
+
+NAN_METHOD(GNNullSink::Attach) {
+    Nan::HandleScope scope;
+
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info[0]->ToObject());
+
+    Local<Object> instance = info.This();
+
+    Local<Value> targetAudioFormatValue = instance->Get(Nan::New<String>("targetAudioFormat").ToLocalChecked());
+    bool resample = !targetAudioFormatValue->IsNull() && !targetAudioFormatValue->IsUndefined();
+    if (resample && !targetAudioFormatValue->IsObject()) {
+        Nan::ThrowTypeError("Expected sink.targetAudioFormat to be an object or null");
+        return;
+    }
+
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
+        return;
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+
+    GrooveSink *sink = gn_sink->sink;
+
+    // without a target format, buffers come out in the format of each file
+    // so that no resampling cost is measured
+    sink->disable_resample = resample ? 0 : 1;
+    if (resample) {
+        Local<Object> targetAudioFormat = targetAudioFormatValue->ToObject();
+
+        Local<Array> layout = Local<Array>::Cast(
+                targetAudioFormat->Get(Nan::New<String>("channelLayout").ToLocalChecked()));
+
+        sink->audio_format.layout.channel_count = layout->Length();
+        for (int ch = 0; ch < sink->audio_format.layout.channel_count; ch += 1) {
+            Local<Value> channelId = layout->Get(Nan::New<Number>(ch));
+            sink->audio_format.layout.channels[ch] = (SoundIoChannelId)(int)channelId->NumberValue();
+        }
+        double sample_fmt = targetAudioFormat->Get(Nan::New<String>("sampleFormat").ToLocalChecked())->NumberValue();
+        sink->audio_format.format = (SoundIoFormat)(int)sample_fmt;
+        sink->audio_format.is_planar = 0;
+
+        double sample_rate = targetAudioFormat->Get(Nan::New<String>("sampleRate").ToLocalChecked())->NumberValue();
+        sink->audio_format.sample_rate = (int)sample_rate;
+    }
+
+    // copy the properties from our instance to the sink
+    gn_sink->event_context->real_time = instance->Get(Nan::New<String>("realTime").ToLocalChecked())->BooleanValue();
+    sink->buffer_size_bytes = (int)instance->Get(Nan::New<String>("bufferSizeBytes").ToLocalChecked())->NumberValue();
+
+    scheduler_queue(new NullSinkAttachWorker(callback, gn_playlist->playlist, gn_sink->event_context, cancel), GNPriorityInteractive);
+}
+
+class NullSinkDetachWorker : public Nan::AsyncWorker {
+public:
+    NullSinkDetachWorker(Nan::Callback *callback, GNNullSink::EventContext *event_context) :
+        Nan::AsyncWorker(callback)
+    {
+        this->event_context = event_context;
+    }
+    ~NullSinkDetachWorker() {}
+
+    void Execute() {
+        position_view_detach(event_context->position_view);
+        uv_mutex_lock(&event_context->mutex);
+        bool running = event_context->running;
+        uv_mutex_unlock(&event_context->mutex);
+        if (!running) {
+            SetErrorMessage("not attached");
+            return;
+        }
+        StopThread(event_context);
+        uv_mutex_lock(&event_context->mutex);
+        event_context->events.clear();
+        uv_mutex_unlock(&event_context->mutex);
+    }
+
+    GNNullSink::EventContext *event_context;
+};
+
+NAN_METHOD(GNNullSink::Detach) {
+    Nan::HandleScope scope;
+
+    if (info.Length() < 1 || !info[0]->IsFunction()) {
+        Nan::ThrowTypeError("Expected function arg[0]");
+        return;
+    }
+    Nan::Callback *callback = new Nan::Callback(info[0].As<Function>());
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(info.This());
+
+    // stop delivering events now rather than when the detach finishes
+    if (gn_sink->event_context->event_source) {
+        event_dispatcher_remove(gn_sink->event_context->event_source);
+        gn_sink->event_context->event_source = NULL;
+    }
+
+    scheduler_queue(new NullSinkDetachWorker(callback, gn_sink->event_context), GNPriorityInteractive);
+}
+
+NAN_METHOD(GNNullSink::PositionView) {
+    Nan::HandleScope scope;
+    GNNullSink *gn_sink = node::ObjectWrap::Unwrap<GNNullSink>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_sink->event_context->position_view));
+}
@@ -0,0 +1,68 @@
+#ifndef GN_NULL_SINK_H
+#define GN_NULL_SINK_H
+
+#include <node.h>
+#include <nan.h>
+#include <groove/groove.h>
+#include <vector>
+#include "position_view.h"
+#include "event_dispatcher.h"
+
+// A sink which stands in for a playback device without needing a sound
+// backend. A thread of its own takes buffers off the playlist and throws
+// them away, either at the rate a device would play them or as fast as the
+// decoder can produce them.
+class GNNullSink : public node::ObjectWrap {
+    public:
+        static void Init();
+        static v8::Local<v8::Value> NewInstance(GrooveSink *sink);
+
+        static NAN_METHOD(Create);
+
+        struct Stats {
+            uint64_t buffer_count;
+            uint64_t frame_count;
+            double audio_duration;
+            uint64_t underrun_count;
+            uint64_t underrun_ns;
+            uint64_t max_lateness_ns;
+            uint64_t total_lateness_ns;
+        };
+
+        struct EventContext {
+            GNEventSource *event_source;
+            uv_thread_t thread;
+            uv_mutex_t mutex;
+            uv_cond_t cond;
+            GrooveSink *sink;
+            Nan::Callback *event_cb;
+            GNPositionView *position_view;
+            bool real_time;
+            // everything below is guarded by mutex
+            bool running;
+            bool abort_request;
+            GroovePlaylistItem *item;
+            double pos;
+            uint64_t attach_time;
+            uint64_t detach_time;
+            Stats stats;
+            std::vector<int> events;
+        };
+
+        EventContext *event_context;
+        GrooveSink *sink;
+
+    private:
+        GNNullSink();
+        ~GNNullSink();
+
+        static NAN_METHOD(New);
+
+        static NAN_METHOD(Attach);
+        static NAN_METHOD(Detach);
+        static NAN_METHOD(Position);
+        static NAN_METHOD(PositionView);
+        static NAN_METHOD(GetStats);
+};
+
+#endif
@@ -1,19 +1,94 @@
+#include <math.h>
+#include <string.h>
 #include "player.h"
+#include "env.h"
 #include "playlist.h"
 #include "playlist_item.h"
 #include "device.h"
 #include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
 
 using namespace v8;
 
 GNPlayer::GNPlayer() {};
 GNPlayer::~GNPlayer() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    position_view_destroy(event_context->position_view);
     groove_player_destroy(player);
+    uv_mutex_destroy(&event_context->mutex);
     delete event_context->event_cb;
     delete event_context;
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
+
+// upper bounds of all but the last jitter histogram bucket
+static const double jitter_bucket_ms[GNPlayer::JitterBucketCount - 1] = {1, 2, 5, 10, 20, 50};
+
+// The play head only moves once per device callback, so a gap between
+// advances counts as a stall only when it is longer than the audio the
+// advance accounts for by more than this: at least one device period, plus
+// the interval at which the publisher samples.
+static const double min_stall_threshold = 0.01;
+static const uint64_t sample_slack_ns = 5000000;
+
+static void PositionFn(void *arg, GroovePlaylistItem **item, double *pos) {
+    GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(arg);
+    GroovePlayer *player = context->player;
+    groove_player_position(player, item, pos);
+
+    GroovePlaylistItem *decode_item;
+    double decode_pos;
+    groove_playlist_position(player->playlist, &decode_item, &decode_pos);
+    bool playing = groove_playlist_playing(player->playlist);
+    double period = player->device ? player->device->software_latency_current : 0.0;
+    if (period < min_stall_threshold)
+        period = min_stall_threshold;
+    uint64_t stall_threshold_ns = (uint64_t)(period * 1000000000.0) + sample_slack_ns;
+    uint64_t now = uv_hrtime();
+
+    uv_mutex_lock(&context->mutex);
+    GNPlayer::Stats *stats = &context->stats;
+    if (*item && *item == decode_item) {
+        double buffered = decode_pos - *pos;
+        if (stats->buffered_count == 0 || buffered < stats->buffered_min)
+            stats->buffered_min = buffered;
+        stats->buffered = buffered;
+        stats->buffered_total += buffered;
+        stats->buffered_count += 1;
+    }
+    if (playing && *item && *item == stats->last_item && stats->last_advance_time) {
+        double advance = *pos - stats->last_pos;
+        if (advance > 0.0) {
+            // measured between advances rather than between samples, so
+            // that samples which fall between two callbacks count nothing
+            uint64_t gap_ns = now - stats->last_advance_time;
+            uint64_t advance_ns = (uint64_t)(advance * 1000000000.0);
+            if (gap_ns > advance_ns + stall_threshold_ns)
+                stats->underrun_ns += gap_ns - advance_ns;
+            double jitter_ms = fabs(advance - gap_ns / 1000000000.0) * 1000.0;
+            int i = 0;
+            while (i < GNPlayer::JitterBucketCount - 1 && jitter_ms >= jitter_bucket_ms[i])
+                i += 1;
+            stats->jitter_histogram[i] += 1;
+            stats->last_advance_time = now;
+            stats->last_pos = *pos;
+        } else if (advance < 0.0) {
+            // a backwards jump is a seek
+            stats->last_advance_time = now;
+            stats->last_pos = *pos;
+        }
+    } else {
+        // paused, stopped or on a new item: start over from here
+        stats->last_advance_time = now;
+        stats->last_item = *item;
+        stats->last_pos = *pos;
+    }
+    uv_mutex_unlock(&context->mutex);
+}
 
 void GNPlayer::Init() {
     // Prepare constructor template
@@ -30,6 +105,9 @@ void GNPlayer::Init() {
     Nan::SetPrototypeMethod(tpl, "attach", Attach);
     Nan::SetPrototypeMethod(tpl, "detach", Detach);
     Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
+    Nan::SetPrototypeMethod(tpl, "stats", GetStats);
+    Nan::SetPrototypeMethod(tpl, "deviceAudioFormat", GetDeviceAudioFormat);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -46,7 +124,7 @@ NAN_METHOD(GNPlayer::New) {
 Local<Value> GNPlayer::NewInstance(GroovePlayer *player) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNPlayer *gn_player = node::ObjectWrap::Unwrap<GNPlayer>(instance);
@@ -92,10 +170,15 @@ NAN_METHOD(GNPlayer::Position) {
     info.GetReturnValue().Set(obj);
 }
 
-static void PlayerEventAsyncCb(uv_async_t *handle) {
+static bool PlayerEventPoll(void *arg) {
+    GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(arg);
+    return groove_player_event_peek(context->player, 0) > 0;
+}
+
+static void PlayerEventFlush(void *arg) {
     Nan::HandleScope scope;
 
-    GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(handle->data);
+    GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(arg);
 
     // flush events
     GroovePlayerEvent event;
@@ -103,6 +186,11 @@ static void PlayerEventAsyncCb(uv_async_t *handle) {
     const unsigned argc = 1;
     Local<Value> argv[argc];
     while (groove_player_event_get(context->player, &event, 0) > 0) {
+        if (event.type == GROOVE_EVENT_BUFFERUNDERRUN) {
+            uv_mutex_lock(&context->mutex);
+            context->stats.underrun_count += 1;
+            uv_mutex_unlock(&context->mutex);
+        }
         argv[0] = Nan::New<Number>(event.type);
 
         TryCatch try_catch;
@@ -111,56 +199,125 @@ static void PlayerEventAsyncCb(uv_async_t *handle) {
         if (try_catch.HasCaught()) {
             node::FatalException(try_catch);
         }
+        // detached by the handler
+        if (!context->event_source)
+            break;
     }
+}
 
+// In coalesced mode, events are taken off the player as soon as they are
+// seen so that they can be timestamped, and delivered in one call.
+static bool PlayerCoalescedEventPoll(void *arg) {
+    GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(arg);
+    GroovePlayerEvent event;
     uv_mutex_lock(&context->mutex);
-    uv_cond_signal(&context->cond);
+    uint64_t now = uv_hrtime();
+    uint64_t since = context->last_poll_time;
+    context->last_poll_time = now;
+    while (groove_player_event_get(context->player, &event, 0) > 0) {
+        if (event.type == GROOVE_EVENT_BUFFERUNDERRUN)
+            context->stats.underrun_count += 1;
+        GNPlayer::QueuedEvent queued_event;
+        queued_event.type = event.type;
+        double pos;
+        groove_player_position(context->player, &queued_event.item, &pos);
+        // Polling only tells that the event happened since the last poll.
+        // A new item started playing pos seconds ago, which is closer.
+        queued_event.time = since + (now - since) / 2;
+        if (event.type == GROOVE_EVENT_NOWPLAYING && queued_event.item && pos >= 0.0) {
+            uint64_t pos_ns = (uint64_t)(pos * 1000000000.0);
+            queued_event.time = (pos_ns < now - since) ? now - pos_ns : since;
+        }
+        context->queued.push_back(queued_event);
+    }
+    bool any = !context->queued.empty();
     uv_mutex_unlock(&context->mutex);
+    return any;
 }
 
-static void PlayerEventThreadEntry(void *arg) {
+static void PlayerCoalescedEventFlush(void *arg) {
+    Nan::HandleScope scope;
+
     GNPlayer::EventContext *context = reinterpret_cast<GNPlayer::EventContext *>(arg);
-    while (groove_player_event_peek(context->player, 1) > 0) {
-        uv_mutex_lock(&context->mutex);
-        uv_async_send(&context->event_async);
-        uv_cond_wait(&context->cond, &context->mutex);
-        uv_mutex_unlock(&context->mutex);
+
+    std::vector<GNPlayer::QueuedEvent> events;
+    uv_mutex_lock(&context->mutex);
+    events.swap(context->queued);
+    uv_mutex_unlock(&context->mutex);
+
+    if (events.empty())
+        return;
+
+    // type, time in ms and item for each event
+    size_t count = events.size() * 3;
+    Local<ArrayBuffer> buffer = ArrayBuffer::New(Isolate::GetCurrent(), count * sizeof(double));
+    double *data = reinterpret_cast<double *>(buffer->GetContents().Data());
+    for (size_t i = 0; i < events.size(); i += 1) {
+        data[i * 3 + 0] = events[i].type;
+        data[i * 3 + 1] = events[i].time / 1000000.0;
+        data[i * 3 + 2] = (double)(uintptr_t)events[i].item;
+    }
+    Local<Float64Array> batch = Float64Array::New(buffer, 0, count);
+
+    const unsigned argc = 1;
+    Local<Value> argv[argc] = {batch};
+    TryCatch try_catch;
+    context->event_cb->Call(argc, argv);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
     }
 }
 
 class PlayerAttachWorker : public Nan::AsyncWorker {
 public:
     PlayerAttachWorker(Nan::Callback *callback, GroovePlayer *player, GroovePlaylist *playlist,
-            GNPlayer::EventContext *event_context) :
+            GNPlayer::EventContext *event_context, GNCancelState *cancel) :
         Nan::AsyncWorker(callback)
     {
         this->player = player;
         this->playlist = playlist;
         this->event_context = event_context;
+        this->cancel = cancel;
+    }
+    ~PlayerAttachWorker() {
+        cancel_state_unref(cancel);
     }
-    ~PlayerAttachWorker() {}
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         int err;
         if ((err = groove_player_attach(player, playlist))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
 
-        GNPlayer::EventContext *context = event_context;
-
-        uv_cond_init(&context->cond);
-        uv_mutex_init(&context->mutex);
+        uv_mutex_lock(&event_context->mutex);
+        memset(&event_context->stats, 0, sizeof(GNPlayer::Stats));
+        uv_mutex_unlock(&event_context->mutex);
 
-        context->event_async.data = context;
-        uv_async_init(uv_default_loop(), &context->event_async, PlayerEventAsyncCb);
+        position_view_attach(event_context->position_view, playlist);
+    }
 
-        uv_thread_create(&context->event_thread, PlayerEventThreadEntry, context);
+    void HandleOKCallback() {
+        GNPlayer::EventContext *context = event_context;
+        context->last_poll_time = uv_hrtime();
+        if (context->coalesce) {
+            context->event_source = event_dispatcher_add(PlayerCoalescedEventPoll,
+                    PlayerCoalescedEventFlush, context);
+        } else {
+            context->event_source = event_dispatcher_add(PlayerEventPoll, PlayerEventFlush, context);
+        }
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GroovePlayer *player;
     GroovePlaylist *playlist;
     GNPlayer::EventContext *event_context;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNPlayer::Create) {
@@ -170,6 +327,21 @@ NAN_METHOD(GNPlayer::Create) {
         Nan::ThrowTypeError("Expected function arg[0]");
         return;
     }
+    bool coalesce = false;
+    if (info.Length() >= 2 && !info[1]->IsUndefined()) {
+        if (!info[1]->IsObject()) {
+            Nan::ThrowTypeError("Expected object arg[1]");
+            return;
+        }
+        Local<Value> coalesce_value = Nan::Get(info[1]->ToObject(),
+                Nan::New<String>("coalesceEvents").ToLocalChecked()).ToLocalChecked();
+        coalesce = coalesce_value->BooleanValue();
+    }
+
+    if (!get_soundio()) {
+        Nan::ThrowError("audio is disabled");
+        return;
+    }
 
     GroovePlayer *player = groove_player_create(get_groove());
     if (!player) {
@@ -183,6 +355,11 @@ NAN_METHOD(GNPlayer::Create) {
     gn_player->event_context = context;
     context->event_cb = new Nan::Callback(info[0].As<Function>());
     context->player = player;
+    context->coalesce = coalesce;
+    context->event_source = NULL;
+    uv_mutex_init(&context->mutex);
+    memset(&context->stats, 0, sizeof(Stats));
+    context->position_view = position_view_create(context, PositionFn);
 
     Nan::Set(instance, Nan::New<String>("device").ToLocalChecked(), Nan::Null());
 
@@ -198,11 +375,6 @@ NAN_METHOD(GNPlayer::Attach) {
         Nan::ThrowTypeError("Expected object arg[0]");
         return;
     }
-    if (info.Length() < 2 || !info[1]->IsFunction()) {
-        Nan::ThrowTypeError("Expected function arg[1]");
-        return;
-    }
-    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
 
     Local<Object> instance = info.This();
 
@@ -210,16 +382,24 @@ NAN_METHOD(GNPlayer::Attach) {
 
     GroovePlayer *player = gn_player->player;
 
-    // copy the properties from our instance to the player
     Local<Value> deviceObject = instance->Get(Nan::New<String>("device").ToLocalChecked());
     if (!deviceObject->IsObject() || deviceObject->IsUndefined() || deviceObject->IsNull()) {
         Nan::ThrowTypeError("Expected player.device to be an object");
         return;
     }
+
+    // nothing below throws, so the token and the callback cannot leak
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
+        return;
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
+
+    // copy the properties from our instance to the player
     GNDevice *gn_device = node::ObjectWrap::Unwrap<GNDevice>(deviceObject->ToObject());
     player->device = gn_device->device;
 
-    AsyncQueueWorker(new PlayerAttachWorker(callback, player, gn_playlist->playlist, gn_player->event_context));
+    scheduler_queue(new PlayerAttachWorker(callback, player, gn_playlist->playlist, gn_player->event_context, cancel), GNPriorityInteractive);
 }
 
 class PlayerDetachWorker : public Nan::AsyncWorker {
@@ -235,15 +415,18 @@ public:
 
     void Execute() {
         int err;
+        position_view_detach(event_context->position_view);
         if ((err = groove_player_detach(player))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
-        uv_cond_signal(&event_context->cond);
-        uv_thread_join(&event_context->event_thread);
-        uv_cond_destroy(&event_context->cond);
-        uv_mutex_destroy(&event_context->mutex);
-        uv_close(reinterpret_cast<uv_handle_t*>(&event_context->event_async), NULL);
+    }
+
+    void HandleOKCallback() {
+        uv_mutex_lock(&event_context->mutex);
+        event_context->queued.clear();
+        uv_mutex_unlock(&event_context->mutex);
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GroovePlayer *player;
@@ -261,5 +444,73 @@ NAN_METHOD(GNPlayer::Detach) {
     GNPlayer *gn_player = node::ObjectWrap::Unwrap<GNPlayer>(info.This());
     GroovePlayer *player = gn_player->player;
 
-    AsyncQueueWorker(new PlayerDetachWorker(callback, player, gn_player->event_context));
+    // stop delivering events now rather than when the detach finishes, so
+    // that none arrive after detach() for a player which is going away
+    EventContext *context = gn_player->event_context;
+    if (context->event_source) {
+        event_dispatcher_remove(context->event_source);
+        context->event_source = NULL;
+    }
+
+    scheduler_queue(new PlayerDetachWorker(callback, player, gn_player->event_context), GNPriorityInteractive);
+}
+
+NAN_METHOD(GNPlayer::PositionView) {
+    Nan::HandleScope scope;
+    GNPlayer *gn_player = node::ObjectWrap::Unwrap<GNPlayer>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_player->event_context->position_view));
+}
+
+NAN_METHOD(GNPlayer::GetStats) {
+    Nan::HandleScope scope;
+    GNPlayer *gn_player = node::ObjectWrap::Unwrap<GNPlayer>(info.This());
+    EventContext *context = gn_player->event_context;
+
+    uv_mutex_lock(&context->mutex);
+    Stats stats = context->stats;
+    uv_mutex_unlock(&context->mutex);
+
+    Local<Object> obj = Nan::New<Object>();
+    Nan::Set(obj, Nan::New<String>("underrunCount").ToLocalChecked(), Nan::New<Number>(stats.underrun_count));
+    Nan::Set(obj, Nan::New<String>("underrunDuration").ToLocalChecked(),
+            Nan::New<Number>(stats.underrun_ns / 1000000000.0));
+    if (stats.buffered_count > 0) {
+        Nan::Set(obj, Nan::New<String>("buffered").ToLocalChecked(), Nan::New<Number>(stats.buffered));
+        Nan::Set(obj, Nan::New<String>("bufferedMin").ToLocalChecked(), Nan::New<Number>(stats.buffered_min));
+        Nan::Set(obj, Nan::New<String>("bufferedMean").ToLocalChecked(),
+                Nan::New<Number>(stats.buffered_total / stats.buffered_count));
+    } else {
+        Nan::Set(obj, Nan::New<String>("buffered").ToLocalChecked(), Nan::Null());
+        Nan::Set(obj, Nan::New<String>("bufferedMin").ToLocalChecked(), Nan::Null());
+        Nan::Set(obj, Nan::New<String>("bufferedMean").ToLocalChecked(), Nan::Null());
+    }
+
+    Local<Array> histogram = Nan::New<Array>();
+    for (int i = 0; i < JitterBucketCount; i += 1)
+        Nan::Set(histogram, Nan::New<Number>(i), Nan::New<Number>(stats.jitter_histogram[i]));
+    Nan::Set(obj, Nan::New<String>("jitterHistogram").ToLocalChecked(), histogram);
+
+    SoundIoDevice *device = gn_player->player->device;
+    if (device) {
+        Nan::Set(obj, Nan::New<String>("softwareLatency").ToLocalChecked(),
+                Nan::New<Number>(device->software_latency_current));
+    } else {
+        Nan::Set(obj, Nan::New<String>("softwareLatency").ToLocalChecked(), Nan::Null());
+    }
+
+    info.GetReturnValue().Set(obj);
+}
+
+NAN_METHOD(GNPlayer::GetDeviceAudioFormat) {
+    Nan::HandleScope scope;
+    GNPlayer *gn_player = node::ObjectWrap::Unwrap<GNPlayer>(info.This());
+    GroovePlayer *player = gn_player->player;
+
+    if (!player->playlist) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+    GrooveAudioFormat format;
+    groove_player_get_device_audio_format(player, &format);
+    info.GetReturnValue().Set(GNDevice::NewAudioFormatObject(&format));
 }
@@ -4,6 +4,9 @@
 #include <node.h>
 #include <nan.h>
 #include <groove/player.h>
+#include <vector>
+#include "position_view.h"
+#include "event_dispatcher.h"
 
 class GNPlayer : public node::ObjectWrap {
     public:
@@ -12,13 +15,50 @@ class GNPlayer : public node::ObjectWrap {
 
         static NAN_METHOD(Create);
 
+        struct QueuedEvent {
+            int type;
+            uint64_t time;
+            GroovePlaylistItem *item;
+        };
+
+        enum { JitterBucketCount = 7 };
+
+        // Sampled by the position view's publisher thread every few
+        // milliseconds while the player is attached, under mutex.
+        struct Stats {
+            uint64_t underrun_count;
+            // time the play head stood still for longer than a device
+            // period while playing
+            uint64_t underrun_ns;
+            // seconds decoded ahead of the play head
+            double buffered;
+            double buffered_min;
+            double buffered_total;
+            uint64_t buffered_count;
+            // how far each advance of the play head was from the time
+            // which passed since the previous one, in buckets of
+            // jitter_bucket_ms
+            uint64_t jitter_histogram[JitterBucketCount];
+            uint64_t last_advance_time;
+            GroovePlaylistItem *last_item;
+            double last_pos;
+        };
+
         struct EventContext {
-            uv_thread_t event_thread;
-            uv_async_t event_async;
-            uv_cond_t cond;
+            GNEventSource *event_source;
             uv_mutex_t mutex;
             GroovePlayer *player;
             Nan::Callback *event_cb;
+            GNPositionView *position_view;
+            // when set, events are taken off the player as soon as the
+            // dispatcher sees them and queued under mutex, and event_cb gets
+            // every queued event in one call
+            bool coalesce;
+            std::vector<QueuedEvent> queued;
+            // when the dispatcher last polled in coalesced mode; an event
+            // it finds happened somewhere between then and now
+            uint64_t last_poll_time;
+            Stats stats;
         };
 
 
@@ -37,6 +77,9 @@ class GNPlayer : public node::ObjectWrap {
         static NAN_METHOD(Attach);
         static NAN_METHOD(Detach);
         static NAN_METHOD(Position);
+        static NAN_METHOD(PositionView);
+        static NAN_METHOD(GetStats);
+        static NAN_METHOD(GetDeviceAudioFormat);
 };
 
 #endif
@@ -1,15 +1,33 @@
 #include <node.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
 #include "playlist.h"
+#include "env.h"
 #include "playlist_item.h"
 #include "file.h"
 #include "groove.h"
 
 using namespace v8;
 
-GNPlaylist::GNPlaylist() { };
-GNPlaylist::~GNPlaylist() { };
+// One wrapper per playlist in each environment, since the wrapper holds the
+// item lookups. It is kept alive from create() until destroy().
+static thread_local std::unordered_map<GroovePlaylist *, GNPlaylist *> wrappers;
 
-static Nan::Persistent<v8::Function> constructor;
+GNPlaylist::GNPlaylist() : index_cache_valid(false), version(0), position_view(NULL) { };
+GNPlaylist::~GNPlaylist() {
+    if (position_view)
+        position_view_destroy(position_view);
+    std::unordered_map<GroovePlaylist *, GNPlaylist *>::iterator it = wrappers.find(playlist);
+    if (it != wrappers.end() && it->second == this)
+        wrappers.erase(it);
+};
+
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *sink, GroovePlaylistItem **item, double *pos) {
+    groove_playlist_position(reinterpret_cast<GroovePlaylist *>(sink), item, pos);
+}
 
 void GNPlaylist::Init() {
     // Prepare constructor template
@@ -21,16 +39,25 @@ void GNPlaylist::Init() {
     // Fields
     Nan::SetAccessor(proto, Nan::New<String>("id").ToLocalChecked(), GetId);
     Nan::SetAccessor(proto, Nan::New<String>("gain").ToLocalChecked(), GetGain);
+    Nan::SetAccessor(proto, Nan::New<String>("version").ToLocalChecked(), GetVersion);
 
     // Methods
     Nan::SetPrototypeMethod(tpl, "destroy", Destroy);
     Nan::SetPrototypeMethod(tpl, "play", Play);
     Nan::SetPrototypeMethod(tpl, "items", Playlist);
+    Nan::SetPrototypeMethod(tpl, "itemsRange", ItemsRange);
     Nan::SetPrototypeMethod(tpl, "pause", Pause);
     Nan::SetPrototypeMethod(tpl, "seek", Seek);
     Nan::SetPrototypeMethod(tpl, "insert", Insert);
     Nan::SetPrototypeMethod(tpl, "remove", Remove);
+    Nan::SetPrototypeMethod(tpl, "insertMany", InsertMany);
+    Nan::SetPrototypeMethod(tpl, "removeMany", RemoveMany);
+    Nan::SetPrototypeMethod(tpl, "move", Move);
+    Nan::SetPrototypeMethod(tpl, "shuffle", Shuffle);
+    Nan::SetPrototypeMethod(tpl, "itemById", ItemById);
+    Nan::SetPrototypeMethod(tpl, "indexOf", IndexOf);
     Nan::SetPrototypeMethod(tpl, "position", DecodePosition);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
     Nan::SetPrototypeMethod(tpl, "playing", Playing);
     Nan::SetPrototypeMethod(tpl, "clear", Clear);
     Nan::SetPrototypeMethod(tpl, "count", Count);
@@ -54,20 +81,83 @@ NAN_METHOD(GNPlaylist::New) {
 Local<Value> GNPlaylist::NewInstance(GroovePlaylist *playlist) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    std::unordered_map<GroovePlaylist *, GNPlaylist *>::iterator it = wrappers.find(playlist);
+    if (it != wrappers.end())
+        return scope.Escape(it->second->handle());
+
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(instance);
     gn_playlist->playlist = playlist;
+    wrappers[playlist] = gn_playlist;
 
     return scope.Escape(instance);
 }
 
+GroovePlaylistItem *GNPlaylist::InsertItem(GrooveFile *file, double gain, double peak,
+        GroovePlaylistItem *next)
+{
+    GroovePlaylistItem *item = groove_playlist_insert(playlist, file, gain, peak, next);
+    if (item)
+        item_set.insert(item);
+    Changed();
+    return item;
+}
+
+void GNPlaylist::RemoveItem(GroovePlaylistItem *item) {
+    GNPlaylistItem::Invalidate(item);
+    groove_playlist_remove(playlist, item);
+    item_set.erase(item);
+    Changed();
+}
+
+void GNPlaylist::InvalidateItems() {
+    for (GroovePlaylistItem *item = playlist->head; item; item = item->next) {
+        GNPlaylistItem::Invalidate(item);
+    }
+    item_set.clear();
+    Changed();
+}
+
+// Item objects outlive their items; once removed they point at nothing.
+static bool require_item(GNPlaylistItem *gn_pl_item) {
+    if (!gn_pl_item->playlist_item) {
+        Nan::ThrowError("playlist item was removed");
+        return false;
+    }
+    return true;
+}
+
+void GNPlaylist::Changed() {
+    version += 1;
+    index_cache_valid = false;
+}
+
+void GNPlaylist::UpdateIndex() {
+    if (index_cache_valid)
+        return;
+    item_list.clear();
+    index_cache.clear();
+    for (GroovePlaylistItem *item = playlist->head; item; item = item->next) {
+        index_cache[item] = (int)item_list.size();
+        item_list.push_back(item);
+    }
+    index_cache_valid = true;
+}
+
 NAN_METHOD(GNPlaylist::Destroy) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+    wrappers.erase(gn_playlist->playlist);
+    if (gn_playlist->position_view) {
+        position_view_destroy(gn_playlist->position_view);
+        gn_playlist->position_view = NULL;
+    }
+    gn_playlist->InvalidateItems();
     groove_playlist_destroy(gn_playlist->playlist);
     gn_playlist->playlist = NULL;
+    gn_playlist->Unref();
 }
 
 NAN_GETTER(GNPlaylist::GetId) {
@@ -82,6 +172,11 @@ NAN_GETTER(GNPlaylist::GetGain) {
     info.GetReturnValue().Set(Nan::New<Number>(gn_playlist->playlist->gain));
 }
 
+NAN_GETTER(GNPlaylist::GetVersion) {
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+    info.GetReturnValue().Set(Nan::New<Number>(gn_playlist->version));
+}
+
 NAN_METHOD(GNPlaylist::Play) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
@@ -106,6 +201,35 @@ NAN_METHOD(GNPlaylist::Playlist) {
     info.GetReturnValue().Set(playlist);
 }
 
+NAN_METHOD(GNPlaylist::ItemsRange) {
+    Nan::HandleScope scope;
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsNumber()) {
+        Nan::ThrowTypeError("Expected number arg[0]");
+        return;
+    }
+    if (info.Length() < 2 || !info[1]->IsNumber()) {
+        Nan::ThrowTypeError("Expected number arg[1]");
+        return;
+    }
+    double start = info[0]->NumberValue();
+    double count = info[1]->NumberValue();
+
+    gn_playlist->UpdateIndex();
+    size_t size = gn_playlist->item_list.size();
+    size_t first = (start > 0) ? ((start < size) ? (size_t)start : size) : 0;
+    size_t last = (count > 0) ? ((count < size - first) ? first + (size_t)count : size) : first;
+
+    Local<Array> items = Nan::New<Array>((int)(last - first));
+    for (size_t i = first; i < last; i += 1) {
+        Nan::Set(items, Nan::New<Number>(i - first),
+                GNPlaylistItem::NewInstance(gn_playlist->item_list[i]));
+    }
+
+    info.GetReturnValue().Set(items);
+}
+
 NAN_METHOD(GNPlaylist::Pause) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
@@ -118,6 +242,8 @@ NAN_METHOD(GNPlaylist::Seek) {
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
     GNPlaylistItem *gn_playlist_item =
         node::ObjectWrap::Unwrap<GNPlaylistItem>(info[0]->ToObject());
+    if (!require_item(gn_playlist_item))
+        return;
 
     double pos = info[1]->NumberValue();
     groove_playlist_seek(gn_playlist->playlist, gn_playlist_item->playlist_item, pos);
@@ -128,6 +254,10 @@ NAN_METHOD(GNPlaylist::Insert) {
 
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
     GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(info[0]->ToObject());
+    if (!gn_file->file) {
+        Nan::ThrowTypeError("Expected an open file");
+        return;
+    }
     double gain = 1.0;
     double peak = 1.0;
     if (!info[1]->IsNull() && !info[1]->IsUndefined()) {
@@ -140,10 +270,11 @@ NAN_METHOD(GNPlaylist::Insert) {
     if (!info[3]->IsNull() && !info[3]->IsUndefined()) {
         GNPlaylistItem *gn_pl_item =
             node::ObjectWrap::Unwrap<GNPlaylistItem>(info[3]->ToObject());
+        if (!require_item(gn_pl_item))
+            return;
         item = gn_pl_item->playlist_item;
     }
-    GroovePlaylistItem *result = groove_playlist_insert(gn_playlist->playlist,
-            gn_file->file, gain, peak, item);
+    GroovePlaylistItem *result = gn_playlist->InsertItem(gn_file->file, gain, peak, item);
 
     info.GetReturnValue().Set(GNPlaylistItem::NewInstance(result));
 }
@@ -152,7 +283,247 @@ NAN_METHOD(GNPlaylist::Remove) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info[0]->ToObject());
-    groove_playlist_remove(gn_playlist->playlist, gn_pl_item->playlist_item);
+    // removing an item twice does nothing
+    if (gn_playlist->item_set.count(gn_pl_item->playlist_item))
+        gn_playlist->RemoveItem(gn_pl_item->playlist_item);
+}
+
+NAN_METHOD(GNPlaylist::InsertMany) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsArray()) {
+        Nan::ThrowTypeError("Expected array arg[0]");
+        return;
+    }
+    Local<Array> entries = Local<Array>::Cast(info[0]);
+
+    GroovePlaylistItem *next = NULL;
+    if (info.Length() >= 2 && !info[1]->IsNull() && !info[1]->IsUndefined()) {
+        GNPlaylistItem *gn_pl_item =
+            node::ObjectWrap::Unwrap<GNPlaylistItem>(info[1]->ToObject());
+        if (!require_item(gn_pl_item))
+            return;
+        next = gn_pl_item->playlist_item;
+    }
+
+    // check everything first so that nothing is inserted on error
+    uint32_t count = entries->Length();
+    std::vector<GrooveFile *> files(count);
+    std::vector<double> gains(count);
+    std::vector<double> peaks(count);
+    Local<String> fileKey = Nan::New<String>("file").ToLocalChecked();
+    Local<String> gainKey = Nan::New<String>("gain").ToLocalChecked();
+    Local<String> peakKey = Nan::New<String>("peak").ToLocalChecked();
+    for (uint32_t i = 0; i < count; i += 1) {
+        Local<Value> entryValue = entries->Get(i);
+        if (!entryValue->IsObject()) {
+            Nan::ThrowTypeError("Expected each entry to be an object");
+            return;
+        }
+        Local<Object> entry = entryValue->ToObject();
+        Local<Value> fileValue = entry->Get(fileKey);
+        if (!fileValue->IsObject()) {
+            Nan::ThrowTypeError("Expected an open file");
+            return;
+        }
+        GNFile *gn_file = node::ObjectWrap::Unwrap<GNFile>(fileValue->ToObject());
+        if (!gn_file->file) {
+            Nan::ThrowTypeError("Expected an open file");
+            return;
+        }
+        files[i] = gn_file->file;
+        Local<Value> gainValue = entry->Get(gainKey);
+        Local<Value> peakValue = entry->Get(peakKey);
+        gains[i] = (gainValue->IsNull() || gainValue->IsUndefined()) ? 1.0 : gainValue->NumberValue();
+        peaks[i] = (peakValue->IsNull() || peakValue->IsUndefined()) ? 1.0 : peakValue->NumberValue();
+    }
+
+    Local<Array> result = Nan::New<Array>(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        GroovePlaylistItem *item = gn_playlist->InsertItem(files[i], gains[i], peaks[i], next);
+        Nan::Set(result, i, GNPlaylistItem::NewInstance(item));
+    }
+
+    info.GetReturnValue().Set(result);
+}
+
+NAN_METHOD(GNPlaylist::RemoveMany) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsArray()) {
+        Nan::ThrowTypeError("Expected array arg[0]");
+        return;
+    }
+    Local<Array> items = Local<Array>::Cast(info[0]);
+
+    uint32_t count = items->Length();
+    std::vector<GroovePlaylistItem *> playlist_items(count);
+    for (uint32_t i = 0; i < count; i += 1) {
+        Local<Value> itemValue = items->Get(i);
+        if (!itemValue->IsObject()) {
+            Nan::ThrowTypeError("Expected each entry to be a playlist item");
+            return;
+        }
+        GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(itemValue->ToObject());
+        playlist_items[i] = gn_pl_item->playlist_item;
+    }
+
+    for (uint32_t i = 0; i < count; i += 1) {
+        // the same item may be listed twice
+        if (gn_playlist->item_set.count(playlist_items[i]))
+            gn_playlist->RemoveItem(playlist_items[i]);
+    }
+}
+
+// libgroove keeps the lock which guards its item links private, so an item
+// cannot be relinked. It is moved by inserting a new item for the same file
+// and removing the old one. The wrapper follows the new item, so item
+// objects held by JavaScript stay valid; only their id changes.
+static void reinsert(GNPlaylist *gn_playlist, GroovePlaylistItem *item, GroovePlaylistItem *next) {
+    GroovePlaylistItem *new_item = gn_playlist->InsertItem(item->file, item->gain, item->peak, next);
+    GNPlaylistItem::Retarget(item, new_item);
+    gn_playlist->RemoveItem(item);
+}
+
+// Removing an item purges its audio from every sink, so the item being
+// decoded and the one before it, whose audio may still be buffered, must
+// stay where they are.
+static bool is_pinned(GroovePlaylist *playlist, GroovePlaylistItem *decoding,
+        GroovePlaylistItem *item)
+{
+    if (item == decoding)
+        return true;
+    return item == (decoding ? decoding->prev : playlist->tail);
+}
+
+NAN_METHOD(GNPlaylist::Move) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info[0]->ToObject());
+    if (!require_item(gn_pl_item))
+        return;
+    GroovePlaylistItem *item = gn_pl_item->playlist_item;
+    GroovePlaylistItem *next = NULL;
+    if (info.Length() >= 2 && !info[1]->IsNull() && !info[1]->IsUndefined()) {
+        GNPlaylistItem *gn_next = node::ObjectWrap::Unwrap<GNPlaylistItem>(info[1]->ToObject());
+        if (!require_item(gn_next))
+            return;
+        next = gn_next->playlist_item;
+    }
+
+    info.GetReturnValue().Set(info[0]);
+    if (item == next || item->next == next)
+        return;
+
+    GroovePlaylistItem *decoding;
+    double pos;
+    groove_playlist_position(gn_playlist->playlist, &decoding, &pos);
+    if (is_pinned(gn_playlist->playlist, decoding, item)) {
+        Nan::ThrowError("cannot move the item being played");
+        return;
+    }
+    reinsert(gn_playlist, item, next);
+}
+
+// xorshift64*, so that a seed gives the same order on every platform
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+NAN_METHOD(GNPlaylist::Shuffle) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+    GroovePlaylist *playlist = gn_playlist->playlist;
+
+    uint64_t state;
+    if (info.Length() >= 1 && info[0]->IsNumber()) {
+        state = (uint64_t)info[0]->NumberValue();
+    } else {
+        state = (uint64_t)uv_hrtime();
+    }
+    // xorshift gets stuck at 0
+    state ^= 0x9E3779B97F4A7C15ULL;
+
+    GroovePlaylistItem *decoding;
+    double pos;
+    groove_playlist_position(playlist, &decoding, &pos);
+
+    // only the items which have not been decoded yet are shuffled; once the
+    // whole playlist has been decoded there are none
+    std::vector<GroovePlaylistItem *> items;
+    for (GroovePlaylistItem *it = decoding ? decoding->next : NULL; it; it = it->next) {
+        items.push_back(it);
+    }
+    for (size_t i = items.size(); i > 1; i -= 1) {
+        size_t j = next_random(&state) % i;
+        GroovePlaylistItem *tmp = items[i - 1];
+        items[i - 1] = items[j];
+        items[j] = tmp;
+    }
+
+    // everything up to and including the item being decoded stays where it
+    // is, keeping its decode state and buffered audio; the items after it
+    // are appended again in shuffled order
+    for (size_t i = 0; i < items.size(); i += 1) {
+        reinsert(gn_playlist, items[i], NULL);
+    }
+}
+
+NAN_METHOD(GNPlaylist::ItemById) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    GroovePlaylistItem *item = NULL;
+    if (info.Length() >= 1 && info[0]->IsNumber()) {
+        // the item field of a position view
+        item = reinterpret_cast<GroovePlaylistItem *>((uintptr_t)info[0]->NumberValue());
+    } else if (info.Length() >= 1 && info[0]->IsString()) {
+        String::Utf8Value id_str(info[0]->ToString());
+        void *ptr = NULL;
+        if (sscanf(*id_str, "%p", &ptr) == 1)
+            item = reinterpret_cast<GroovePlaylistItem *>(ptr);
+    } else {
+        Nan::ThrowTypeError("Expected string arg[0]");
+        return;
+    }
+    if (!item || !gn_playlist->item_set.count(item)) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
+    info.GetReturnValue().Set(GNPlaylistItem::NewInstance(item));
+}
+
+NAN_METHOD(GNPlaylist::IndexOf) {
+    Nan::HandleScope scope;
+
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+
+    if (info.Length() < 1 || !info[0]->IsObject()) {
+        Nan::ThrowTypeError("Expected object arg[0]");
+        return;
+    }
+    GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info[0]->ToObject());
+
+    gn_playlist->UpdateIndex();
+    std::unordered_map<GroovePlaylistItem *, int>::iterator it =
+        gn_playlist->index_cache.find(gn_pl_item->playlist_item);
+    int index = (it == gn_playlist->index_cache.end()) ? -1 : it->second;
+    info.GetReturnValue().Set(Nan::New<Number>(index));
 }
 
 NAN_METHOD(GNPlaylist::DecodePosition) {
@@ -171,6 +542,22 @@ NAN_METHOD(GNPlaylist::DecodePosition) {
     info.GetReturnValue().Set(obj);
 }
 
+NAN_METHOD(GNPlaylist::PositionView) {
+    Nan::HandleScope scope;
+    GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+    if (!gn_playlist->playlist) {
+        Nan::ThrowTypeError("playlist is destroyed");
+        return;
+    }
+    // attached on first use, so that playlists nobody watches do not keep
+    // the publisher thread busy
+    if (!gn_playlist->position_view) {
+        gn_playlist->position_view = position_view_create(gn_playlist->playlist, PositionFn);
+        position_view_attach(gn_playlist->position_view, gn_playlist->playlist);
+    }
+    info.GetReturnValue().Set(position_view_get_array(gn_playlist->position_view));
+}
+
 NAN_METHOD(GNPlaylist::Playing) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
@@ -181,6 +568,7 @@ NAN_METHOD(GNPlaylist::Playing) {
 NAN_METHOD(GNPlaylist::Clear) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
+    gn_playlist->InvalidateItems();
     groove_playlist_clear(gn_playlist->playlist);
 }
 
@@ -195,9 +583,12 @@ NAN_METHOD(GNPlaylist::SetItemGainPeak) {
     Nan::HandleScope scope;
     GNPlaylist *gn_playlist = node::ObjectWrap::Unwrap<GNPlaylist>(info.This());
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info[0]->ToObject());
+    if (!require_item(gn_pl_item))
+        return;
     double gain = info[1]->NumberValue();
     double peak = info[2]->NumberValue();
     groove_playlist_set_item_gain_peak(gn_playlist->playlist, gn_pl_item->playlist_item, gain, peak);
+    gn_playlist->version += 1;
 }
 
 NAN_METHOD(GNPlaylist::SetGain) {
@@ -217,5 +608,6 @@ NAN_METHOD(GNPlaylist::Create) {
     Nan::HandleScope scope;
     GroovePlaylist *playlist = groove_playlist_create(get_groove());
     Local<Value> tmp = GNPlaylist::NewInstance(playlist);
+    node::ObjectWrap::Unwrap<GNPlaylist>(tmp->ToObject())->Ref();
     info.GetReturnValue().Set(tmp);
 }
@@ -4,6 +4,10 @@
 #include <node.h>
 #include <nan.h>
 #include <groove/groove.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "position_view.h"
 
 class GNPlaylist : public node::ObjectWrap {
     public:
@@ -14,6 +18,29 @@ class GNPlaylist : public node::ObjectWrap {
 
         GroovePlaylist *playlist;
 
+        // All changes to the items go through these so that the lookups
+        // below stay correct.
+        GroovePlaylistItem *InsertItem(GrooveFile *file, double gain, double peak,
+                GroovePlaylistItem *next);
+        void RemoveItem(GroovePlaylistItem *item);
+        // for when every item is about to go away at once
+        void InvalidateItems();
+
+        // bumps version and drops the cached index
+        void Changed();
+        // rebuilds item_list and index_cache if the playlist changed
+        void UpdateIndex();
+
+        // every item in the playlist, for checking ids
+        std::unordered_set<GroovePlaylistItem *> item_set;
+        // the items in order and the position of each, rebuilt lazily
+        std::vector<GroovePlaylistItem *> item_list;
+        std::unordered_map<GroovePlaylistItem *, int> index_cache;
+        bool index_cache_valid;
+        // incremented on every change to the items
+        uint32_t version;
+        // publishes the decode head; NULL once destroyed
+        GNPositionView *position_view;
 
     private:
         GNPlaylist();
@@ -24,15 +51,24 @@ class GNPlaylist : public node::ObjectWrap {
 
         static NAN_GETTER(GetId);
         static NAN_GETTER(GetGain);
+        static NAN_GETTER(GetVersion);
 
         static NAN_METHOD(Playlist);
+        static NAN_METHOD(ItemsRange);
         static NAN_METHOD(Play);
         static NAN_METHOD(Pause);
         static NAN_METHOD(Seek);
         static NAN_METHOD(Insert);
         static NAN_METHOD(Remove);
+        static NAN_METHOD(InsertMany);
+        static NAN_METHOD(RemoveMany);
+        static NAN_METHOD(Move);
+        static NAN_METHOD(Shuffle);
+        static NAN_METHOD(ItemById);
+        static NAN_METHOD(IndexOf);
         static NAN_METHOD(Position);
         static NAN_METHOD(DecodePosition);
+        static NAN_METHOD(PositionView);
         static NAN_METHOD(Playing);
         static NAN_METHOD(Clear);
         static NAN_METHOD(Count);
@@ -1,12 +1,24 @@
+#include <unordered_map>
 #include "playlist_item.h"
+#include "env.h"
 #include "file.h"
 
 using namespace v8;
 
-GNPlaylistItem::GNPlaylistItem() { };
-GNPlaylistItem::~GNPlaylistItem() { };
+// One wrapper per item in each environment, so that items compare with ===
+// and the hot paths (position, sink buffers, items()) do not allocate.
+// Wrappers are weak; the entry goes away when the wrapper is collected.
+static thread_local std::unordered_map<GroovePlaylistItem *, GNPlaylistItem *> wrappers;
 
-static Nan::Persistent<v8::Function> constructor;
+GNPlaylistItem::GNPlaylistItem() : playlist_item(NULL) { };
+GNPlaylistItem::~GNPlaylistItem() {
+    std::unordered_map<GroovePlaylistItem *, GNPlaylistItem *>::iterator it =
+        wrappers.find(playlist_item);
+    if (it != wrappers.end() && it->second == this)
+        wrappers.erase(it);
+};
+
+static GNEnvPersistent<v8::Function> constructor;
 
 void GNPlaylistItem::Init() {
     // Prepare constructor template
@@ -36,23 +48,57 @@ NAN_METHOD(GNPlaylistItem::New) {
 Local<Value> GNPlaylistItem::NewInstance(GroovePlaylistItem *playlist_item) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    std::unordered_map<GroovePlaylistItem *, GNPlaylistItem *>::iterator it =
+        wrappers.find(playlist_item);
+    if (it != wrappers.end())
+        return scope.Escape(it->second->handle());
+
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNPlaylistItem *gn_playlist_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(instance);
     gn_playlist_item->playlist_item = playlist_item;
+    wrappers[playlist_item] = gn_playlist_item;
 
     return scope.Escape(instance);
 }
 
+void GNPlaylistItem::Retarget(GroovePlaylistItem *old_item, GroovePlaylistItem *new_item) {
+    std::unordered_map<GroovePlaylistItem *, GNPlaylistItem *>::iterator it =
+        wrappers.find(old_item);
+    if (it == wrappers.end())
+        return;
+    GNPlaylistItem *gn_playlist_item = it->second;
+    wrappers.erase(it);
+    gn_playlist_item->playlist_item = new_item;
+    wrappers[new_item] = gn_playlist_item;
+}
+
+void GNPlaylistItem::Invalidate(GroovePlaylistItem *item) {
+    std::unordered_map<GroovePlaylistItem *, GNPlaylistItem *>::iterator it =
+        wrappers.find(item);
+    if (it == wrappers.end())
+        return;
+    it->second->playlist_item = NULL;
+    wrappers.erase(it);
+}
+
 NAN_GETTER(GNPlaylistItem::GetFile) {
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info.This());
+    if (!gn_pl_item->playlist_item) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
     Local<Value> tmp = GNFile::NewInstance(gn_pl_item->playlist_item->file);
     info.GetReturnValue().Set(tmp);
 }
 
 NAN_GETTER(GNPlaylistItem::GetId) {
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info.This());
+    if (!gn_pl_item->playlist_item) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
     char buf[64];
     snprintf(buf, sizeof(buf), "%p", gn_pl_item->playlist_item);
     info.GetReturnValue().Set(Nan::New<String>(buf).ToLocalChecked());
@@ -60,12 +106,20 @@ NAN_GETTER(GNPlaylistItem::GetId) {
 
 NAN_GETTER(GNPlaylistItem::GetGain) {
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info.This());
+    if (!gn_pl_item->playlist_item) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
     double gain = gn_pl_item->playlist_item->gain;
     info.GetReturnValue().Set(Nan::New<Number>(gain));
 }
 
 NAN_GETTER(GNPlaylistItem::GetPeak) {
     GNPlaylistItem *gn_pl_item = node::ObjectWrap::Unwrap<GNPlaylistItem>(info.This());
+    if (!gn_pl_item->playlist_item) {
+        info.GetReturnValue().Set(Nan::Null());
+        return;
+    }
     double peak = gn_pl_item->playlist_item->peak;
     info.GetReturnValue().Set(Nan::New<Number>(peak));
 }
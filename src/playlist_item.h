@@ -9,7 +9,15 @@ class GNPlaylistItem : public node::ObjectWrap {
     public:
         static void Init();
         static v8::Local<v8::Value> NewInstance(GroovePlaylistItem *playlist_item);
-
+        // Points the wrapper of old_item, if there is one, at new_item, for
+        // when an item had to be replaced to move it.
+        static void Retarget(GroovePlaylistItem *old_item, GroovePlaylistItem *new_item);
+        // Detaches the wrapper of item, if there is one, before the item is
+        // freed. Call this whenever an item leaves its playlist, since the
+        // address may be reused for another item.
+        static void Invalidate(GroovePlaylistItem *item);
+
+        // NULL once the item has been removed from its playlist
         GroovePlaylistItem *playlist_item;
     private:
         GNPlaylistItem();
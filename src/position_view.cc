@@ -0,0 +1,147 @@
+#include <uv.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "position_view.h"
+
+using namespace v8;
+
+// how often attached views are updated
+static const uint64_t publish_interval_ns = 4000000;
+
+struct GNPositionView {
+    double *data;
+    void *sink;
+    GNPositionFn position_fn;
+    GroovePlaylist *playlist;
+    std::atomic<int> ref_count;
+    // holds one of the references while it is set
+    Nan::Persistent<Float64Array> array;
+};
+
+// One thread updates every attached view. It sleeps on the cond while
+// nothing is attached.
+static uv_once_t publisher_once = UV_ONCE_INIT;
+static uv_mutex_t publisher_mutex;
+static uv_cond_t publisher_cond;
+static uv_thread_t publisher_thread;
+static bool publisher_started = false;
+static std::vector<GNPositionView *> attached;
+
+static void write_fields(GNPositionView *view, double pos, double item,
+        double playing, double buffered)
+{
+    volatile double *data = view->data;
+    data[GNPositionViewPos] = pos;
+    data[GNPositionViewItem] = item;
+    data[GNPositionViewPlaying] = playing;
+    data[GNPositionViewBuffered] = buffered;
+    data[GNPositionViewUpdateCount] = data[GNPositionViewUpdateCount] + 1;
+}
+
+static void publish(GNPositionView *view) {
+    GroovePlaylistItem *item = NULL;
+    double pos = -1.0;
+    view->position_fn(view->sink, &item, &pos);
+
+    GroovePlaylistItem *decode_item = NULL;
+    double decode_pos = -1.0;
+    groove_playlist_position(view->playlist, &decode_item, &decode_pos);
+
+    // item may be removed by the main thread at any time, so it is only
+    // compared, never dereferenced
+    double buffered = (item && item == decode_item) ? decode_pos - pos : -1.0;
+    double playing = groove_playlist_playing(view->playlist) ? 1.0 : 0.0;
+    write_fields(view, pos, (double)(uintptr_t)item, playing, buffered);
+}
+
+static void PublisherThreadEntry(void *arg) {
+    uv_mutex_lock(&publisher_mutex);
+    for (;;) {
+        if (attached.empty()) {
+            uv_cond_wait(&publisher_cond, &publisher_mutex);
+            continue;
+        }
+        for (size_t i = 0; i < attached.size(); i += 1)
+            publish(attached[i]);
+        uv_cond_timedwait(&publisher_cond, &publisher_mutex, publish_interval_ns);
+    }
+}
+
+static void init_publisher_mutex(void) {
+    uv_mutex_init(&publisher_mutex);
+    uv_cond_init(&publisher_cond);
+}
+
+static void unref_view(GNPositionView *view) {
+    if (view->ref_count.fetch_sub(1) == 1) {
+        free(view->data);
+        delete view;
+    }
+}
+
+static void free_array_data(char *data, void *hint) {
+    unref_view(reinterpret_cast<GNPositionView *>(hint));
+}
+
+GNPositionView *position_view_create(void *sink, GNPositionFn position_fn) {
+    GNPositionView *view = new GNPositionView;
+    view->data = reinterpret_cast<double *>(calloc(GNPositionViewFieldCount, sizeof(double)));
+    view->sink = sink;
+    view->position_fn = position_fn;
+    view->playlist = NULL;
+    view->ref_count = 1;
+    return view;
+}
+
+void position_view_destroy(GNPositionView *view) {
+    position_view_detach(view);
+    // the array unrefs the view once it is garbage collected
+    view->array.Reset();
+    unref_view(view);
+}
+
+void position_view_attach(GNPositionView *view, GroovePlaylist *playlist) {
+    uv_once(&publisher_once, init_publisher_mutex);
+    uv_mutex_lock(&publisher_mutex);
+    if (!publisher_started) {
+        uv_thread_create(&publisher_thread, PublisherThreadEntry, NULL);
+        publisher_started = true;
+    }
+    if (!view->playlist)
+        attached.push_back(view);
+    view->playlist = playlist;
+    uv_cond_signal(&publisher_cond);
+    uv_mutex_unlock(&publisher_mutex);
+}
+
+void position_view_detach(GNPositionView *view) {
+    uv_once(&publisher_once, init_publisher_mutex);
+    uv_mutex_lock(&publisher_mutex);
+    if (view->playlist) {
+        attached.erase(std::find(attached.begin(), attached.end(), view));
+        view->playlist = NULL;
+        write_fields(view, 0.0, 0.0, 0.0, 0.0);
+    }
+    uv_mutex_unlock(&publisher_mutex);
+}
+
+Local<Value> position_view_get_array(GNPositionView *view) {
+    Nan::EscapableHandleScope scope;
+
+    if (!view->array.IsEmpty())
+        return scope.Escape(Nan::New(view->array));
+
+    view->ref_count += 1;
+    size_t size = GNPositionViewFieldCount * sizeof(double);
+    Local<Object> buffer = Nan::NewBuffer(reinterpret_cast<char *>(view->data), size,
+            free_array_data, view).ToLocalChecked();
+    Local<Uint8Array> bytes = buffer.As<Uint8Array>();
+    Local<Float64Array> array = Float64Array::New(bytes->Buffer(), bytes->ByteOffset(),
+            GNPositionViewFieldCount);
+    view->array.Reset(array);
+
+    return scope.Escape(array);
+}
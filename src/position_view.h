@@ -0,0 +1,44 @@
+#ifndef GN_POSITION_VIEW_H
+#define GN_POSITION_VIEW_H
+
+#include <node.h>
+#include <nan.h>
+#include <groove/groove.h>
+
+// Layout of the Float64Array returned by positionView(). Fields are written
+// by a background thread while JavaScript may be reading them, with nothing
+// JavaScript can use to wait for a write to finish, so a read can mix fields
+// from different updates.
+enum GNPositionViewField {
+    // bumped after every update
+    GNPositionViewUpdateCount,
+    GNPositionViewPos,
+    // the item's address, as accepted by playlist.itemById; 0 for none
+    GNPositionViewItem,
+    GNPositionViewPlaying,
+    // seconds decoded ahead of pos in the same item, or -1 if unknown
+    GNPositionViewBuffered,
+    GNPositionViewFieldCount,
+};
+
+// Reads the current position of a sink. Called from the publisher thread.
+typedef void (*GNPositionFn)(void *sink, GroovePlaylistItem **item, double *pos);
+
+struct GNPositionView;
+
+GNPositionView *position_view_create(void *sink, GNPositionFn position_fn);
+// Detaches the view and drops the owner's reference. The memory stays valid
+// until the array over it has been garbage collected as well. Main thread
+// only.
+void position_view_destroy(GNPositionView *view);
+
+// Start or stop updating the view. May be called from any thread. After
+// detach returns, position_fn will not be called again.
+void position_view_attach(GNPositionView *view, GroovePlaylist *playlist);
+void position_view_detach(GNPositionView *view);
+
+// Returns the Float64Array over the view's memory, which is created on the
+// first call and returned again by every later one.
+v8::Local<v8::Value> position_view_get_array(GNPositionView *view);
+
+#endif
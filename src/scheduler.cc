@@ -0,0 +1,216 @@
+#include <uv.h>
+#include <deque>
+#include <vector>
+#include <string.h>
+#include "scheduler.h"
+#include "env.h"
+
+using namespace v8;
+
+static const int default_thread_count = 4;
+
+// Finished workers are handed back to the environment which queued them,
+// through one of these per environment.
+struct Completion {
+    uv_async_t complete_async;
+    // these are guarded by mutex
+    std::vector<Nan::AsyncWorker *> completed;
+    int outstanding;
+    // the environment has shut down
+    bool closed;
+    bool handle_closed;
+};
+
+struct Job {
+    Nan::AsyncWorker *worker;
+    Completion *completion;
+};
+
+static uv_once_t init_once = UV_ONCE_INIT;
+static uv_mutex_t mutex;
+static uv_cond_t cond;
+
+// guarded by mutex
+static bool started = false;
+static int thread_count = default_thread_count;
+static std::vector<uv_thread_t> threads;
+static std::deque<Job> interactive_queue;
+static std::deque<Job> background_queue;
+
+static thread_local Completion *env_completion = NULL;
+
+struct ThreadInfo {
+    bool interactive_only;
+};
+
+static void ThreadEntry(void *arg) {
+    ThreadInfo *thread_info = reinterpret_cast<ThreadInfo *>(arg);
+    uv_mutex_lock(&mutex);
+    for (;;) {
+        Job job;
+        if (!interactive_queue.empty()) {
+            job = interactive_queue.front();
+            interactive_queue.pop_front();
+        } else if (!thread_info->interactive_only && !background_queue.empty()) {
+            job = background_queue.front();
+            background_queue.pop_front();
+        } else {
+            uv_cond_wait(&cond, &mutex);
+            continue;
+        }
+        uv_mutex_unlock(&mutex);
+
+        job.worker->Execute();
+
+        uv_mutex_lock(&mutex);
+        Completion *completion = job.completion;
+        if (!completion->closed) {
+            completion->completed.push_back(job.worker);
+            uv_async_send(&completion->complete_async);
+        } else {
+            // The worker's handles belong to an isolate which is gone, so
+            // it cannot even be deleted.
+            completion->outstanding -= 1;
+            if (completion->handle_closed && completion->outstanding == 0)
+                delete completion;
+        }
+    }
+}
+
+static void CompleteAsyncCb(uv_async_t *handle) {
+    Nan::HandleScope scope;
+
+    Completion *completion = reinterpret_cast<Completion *>(handle->data);
+    std::vector<Nan::AsyncWorker *> done;
+    uv_mutex_lock(&mutex);
+    done.swap(completion->completed);
+    uv_mutex_unlock(&mutex);
+
+    for (size_t i = 0; i < done.size(); i += 1) {
+        done[i]->WorkComplete();
+        done[i]->Destroy();
+    }
+
+    uv_mutex_lock(&mutex);
+    completion->outstanding -= (int)done.size();
+    bool idle = (completion->outstanding == 0);
+    uv_mutex_unlock(&mutex);
+    // let the environment exit when nothing is in flight
+    if (idle)
+        uv_unref(reinterpret_cast<uv_handle_t*>(&completion->complete_async));
+}
+
+static void CompletionCloseCb(uv_handle_t *handle) {
+    Completion *completion = reinterpret_cast<Completion *>(handle->data);
+    uv_mutex_lock(&mutex);
+    completion->handle_closed = true;
+    bool unused = (completion->outstanding == 0);
+    uv_mutex_unlock(&mutex);
+    if (unused)
+        delete completion;
+}
+
+static void close_completion(void *arg) {
+    Completion *completion = reinterpret_cast<Completion *>(arg);
+    std::vector<Nan::AsyncWorker *> done;
+    uv_mutex_lock(&mutex);
+    completion->closed = true;
+    done.swap(completion->completed);
+    completion->outstanding -= (int)done.size();
+    uv_mutex_unlock(&mutex);
+
+    for (size_t i = 0; i < done.size(); i += 1)
+        done[i]->Destroy();
+
+    env_completion = NULL;
+    uv_close(reinterpret_cast<uv_handle_t*>(&completion->complete_async), CompletionCloseCb);
+}
+
+static Completion *get_completion(void) {
+    if (env_completion)
+        return env_completion;
+    Completion *completion = new Completion;
+    completion->outstanding = 0;
+    completion->closed = false;
+    completion->handle_closed = false;
+    completion->complete_async.data = completion;
+    uv_async_init(env_loop(), &completion->complete_async, CompleteAsyncCb);
+    uv_unref(reinterpret_cast<uv_handle_t*>(&completion->complete_async));
+    env_at_exit(close_completion, completion);
+    env_completion = completion;
+    return completion;
+}
+
+static void init_mutex(void) {
+    uv_mutex_init(&mutex);
+    uv_cond_init(&cond);
+}
+
+// call with mutex held
+static void start(void) {
+    started = true;
+    threads.resize(thread_count);
+    for (int i = 0; i < thread_count; i += 1) {
+        ThreadInfo *thread_info = new ThreadInfo;
+        thread_info->interactive_only = (i == 0 && thread_count > 1);
+        uv_thread_create(&threads[i], ThreadEntry, thread_info);
+    }
+}
+
+void scheduler_queue(Nan::AsyncWorker *worker, GNPriority priority) {
+    uv_once(&init_once, init_mutex);
+    Completion *completion = get_completion();
+
+    Job job;
+    job.worker = worker;
+    job.completion = completion;
+
+    uv_mutex_lock(&mutex);
+    if (!started)
+        start();
+    if (completion->outstanding == 0)
+        uv_ref(reinterpret_cast<uv_handle_t*>(&completion->complete_async));
+    completion->outstanding += 1;
+    if (priority == GNPriorityInteractive) {
+        interactive_queue.push_back(job);
+    } else {
+        background_queue.push_back(job);
+    }
+    uv_cond_broadcast(&cond);
+    uv_mutex_unlock(&mutex);
+}
+
+int scheduler_set_thread_count(int count) {
+    if (count < 1)
+        return UV_EINVAL;
+    uv_once(&init_once, init_mutex);
+    uv_mutex_lock(&mutex);
+    int err = 0;
+    if (started) {
+        err = UV_EBUSY;
+    } else {
+        thread_count = count;
+    }
+    uv_mutex_unlock(&mutex);
+    return err;
+}
+
+int scheduler_get_thread_count(void) {
+    uv_once(&init_once, init_mutex);
+    uv_mutex_lock(&mutex);
+    int count = thread_count;
+    uv_mutex_unlock(&mutex);
+    return count;
+}
+
+GNPriority scheduler_get_priority(Local<Object> options, GNPriority default_priority) {
+    Local<Value> priorityValue = options->Get(Nan::New<String>("priority").ToLocalChecked());
+    if (!priorityValue->IsString())
+        return default_priority;
+    String::Utf8Value priority_str(priorityValue->ToString());
+    if (strcmp(*priority_str, "background") == 0)
+        return GNPriorityBackground;
+    if (strcmp(*priority_str, "interactive") == 0)
+        return GNPriorityInteractive;
+    return default_priority;
+}
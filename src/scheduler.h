@@ -0,0 +1,31 @@
+#ifndef GN_SCHEDULER_H
+#define GN_SCHEDULER_H
+
+#include <node.h>
+#include <nan.h>
+
+enum GNPriority {
+    // something a user is waiting for, such as opening a song to play it
+    GNPriorityInteractive,
+    // bulk work which may take as long as it needs
+    GNPriorityBackground,
+};
+
+// Runs worker->Execute() on one of the scheduler's threads, then
+// WorkComplete() and Destroy() on the main thread, like AsyncQueueWorker.
+// Interactive workers are always taken first, and one thread only ever runs
+// interactive workers so that they never wait behind background work.
+void scheduler_queue(Nan::AsyncWorker *worker, GNPriority priority);
+
+// Must be called before anything has been queued. Returns 0 or a negative
+// libuv error code.
+int scheduler_set_thread_count(int thread_count);
+
+// Returns how many threads the scheduler runs, or will run once work is
+// queued.
+int scheduler_get_thread_count(void);
+
+// Reads options.priority, which may be "interactive" or "background".
+GNPriority scheduler_get_priority(v8::Local<v8::Object> options, GNPriority default_priority);
+
+#endif
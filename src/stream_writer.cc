@@ -0,0 +1,120 @@
+#include <node_buffer.h>
+#include "stream_writer.h"
+#include "env.h"
+
+using namespace v8;
+
+GNStreamWriter::GNStreamWriter() : io(NULL), drain_context(NULL) {};
+GNStreamWriter::~GNStreamWriter() {
+    Release();
+};
+
+static GNEnvPersistent<v8::Function> constructor;
+
+void GNStreamWriter::Init() {
+    // Prepare constructor template
+    Local<FunctionTemplate> tpl = Nan::New<FunctionTemplate>(New);
+    tpl->SetClassName(Nan::New<String>("GrooveStreamWriter").ToLocalChecked());
+    tpl->InstanceTemplate()->SetInternalFieldCount(1);
+
+    // Methods
+    Nan::SetPrototypeMethod(tpl, "write", Write);
+    Nan::SetPrototypeMethod(tpl, "end", End);
+    Nan::SetPrototypeMethod(tpl, "abort", Abort);
+
+    constructor.Reset(tpl->GetFunction());
+}
+
+NAN_METHOD(GNStreamWriter::New) {
+    Nan::HandleScope scope;
+
+    GNStreamWriter *obj = new GNStreamWriter();
+    obj->Wrap(info.This());
+
+    info.GetReturnValue().Set(info.This());
+}
+
+static void DrainAsyncCb(uv_async_t *handle) {
+    Nan::HandleScope scope;
+
+    GNStreamWriter::DrainContext *context =
+        reinterpret_cast<GNStreamWriter::DrainContext *>(handle->data);
+
+    TryCatch try_catch;
+    context->drain_cb->Call(0, NULL);
+
+    if (try_catch.HasCaught()) {
+        node::FatalException(try_catch);
+    }
+}
+
+static void DrainCloseCb(uv_handle_t *handle) {
+    GNStreamWriter::DrainContext *context =
+        reinterpret_cast<GNStreamWriter::DrainContext *>(handle->data);
+    delete context->drain_cb;
+    delete context;
+}
+
+Local<Value> GNStreamWriter::NewInstance(GNFileIo *io, Nan::Callback *drain_cb) {
+    Nan::EscapableHandleScope scope;
+
+    Local<Function> cons = constructor.Get();
+    Local<Object> instance = cons->NewInstance();
+
+    GNStreamWriter *gn_writer = node::ObjectWrap::Unwrap<GNStreamWriter>(instance);
+    gn_writer->io = io;
+
+    DrainContext *context = new DrainContext;
+    gn_writer->drain_context = context;
+    context->drain_cb = drain_cb;
+    context->drain_async.data = context;
+    uv_async_init(env_loop(), &context->drain_async, DrainAsyncCb);
+    file_io_stream_set_drain_async(io, &context->drain_async);
+
+    return scope.Escape(instance);
+}
+
+void GNStreamWriter::Release() {
+    if (!io)
+        return;
+    // after this the reader no longer touches drain_async
+    file_io_stream_release(io);
+    io = NULL;
+    uv_close(reinterpret_cast<uv_handle_t*>(&drain_context->drain_async), DrainCloseCb);
+    drain_context = NULL;
+}
+
+NAN_METHOD(GNStreamWriter::Write) {
+    Nan::HandleScope scope;
+
+    GNStreamWriter *gn_writer = node::ObjectWrap::Unwrap<GNStreamWriter>(info.This());
+
+    if (info.Length() < 1 || !node::Buffer::HasInstance(info[0])) {
+        Nan::ThrowTypeError("Expected Buffer arg[0]");
+        return;
+    }
+    if (!gn_writer->io) {
+        Nan::ThrowError("write after end");
+        return;
+    }
+
+    Local<Object> buffer = info[0]->ToObject();
+    int written = file_io_stream_write(gn_writer->io, node::Buffer::Data(buffer),
+            (int)node::Buffer::Length(buffer));
+    info.GetReturnValue().Set(Nan::New<Number>(written));
+}
+
+NAN_METHOD(GNStreamWriter::End) {
+    Nan::HandleScope scope;
+    GNStreamWriter *gn_writer = node::ObjectWrap::Unwrap<GNStreamWriter>(info.This());
+    gn_writer->Release();
+}
+
+NAN_METHOD(GNStreamWriter::Abort) {
+    Nan::HandleScope scope;
+    GNStreamWriter *gn_writer = node::ObjectWrap::Unwrap<GNStreamWriter>(info.This());
+    if (!gn_writer->io)
+        return;
+    file_io_stream_abort(gn_writer->io);
+    gn_writer->Release();
+}
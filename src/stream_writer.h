@@ -0,0 +1,33 @@
+#ifndef GN_STREAM_WRITER_H
+#define GN_STREAM_WRITER_H
+
+#include <node.h>
+#include <nan.h>
+#include "file_io.h"
+
+class GNStreamWriter : public node::ObjectWrap {
+    public:
+        static void Init();
+        static v8::Local<v8::Value> NewInstance(GNFileIo *io, Nan::Callback *drain_cb);
+
+        struct DrainContext {
+            uv_async_t drain_async;
+            Nan::Callback *drain_cb;
+        };
+
+        GNFileIo *io;
+        DrainContext *drain_context;
+    private:
+        GNStreamWriter();
+        ~GNStreamWriter();
+
+        void Release();
+
+        static NAN_METHOD(New);
+
+        static NAN_METHOD(Write);
+        static NAN_METHOD(End);
+        static NAN_METHOD(Abort);
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include <uv.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "tag_writer.h"
+
+/* A FLAC file is "fLaC" followed by metadata blocks, each with a 4 byte
+ * header: 1 bit last-block flag, 7 bits block type, 24 bits big endian
+ * length. The Vorbis comment block is rewritten in the space it already
+ * occupies plus any padding blocks directly around it.
+ */
+
+static const int flac_block_padding = 1;
+static const int flac_block_vorbis_comment = 4;
+static const int64_t flac_max_block_size = (1 << 24) - 1;
+static const int flac_max_blocks = 1024;
+
+struct FlacBlock {
+    int64_t offset;
+    int64_t size;
+    int type;
+    bool last;
+};
+
+// libavformat renames these Vorbis comment keys when reading and renames
+// them back when remuxing
+static const char *key_conv[][2] = {
+    {"ALBUMARTIST", "album_artist"},
+    {"TRACKNUMBER", "track"},
+    {"DISCNUMBER", "disc"},
+    {"DESCRIPTION", "comment"},
+};
+
+static const char *vorbis_comment_key(const char *key) {
+    for (size_t i = 0; i < sizeof(key_conv) / sizeof(key_conv[0]); i += 1) {
+        if (strcmp(key, key_conv[i][1]) == 0)
+            return key_conv[i][0];
+    }
+    return key;
+}
+
+static int read_at(uv_file fd, char *dest, int64_t size, int64_t offset) {
+    int64_t total = 0;
+    while (total < size) {
+        uv_buf_t buf = uv_buf_init(dest + total, (unsigned int)(size - total));
+        uv_fs_t req;
+        int amt = uv_fs_read(uv_default_loop(), &req, fd, &buf, 1, offset + total, NULL);
+        uv_fs_req_cleanup(&req);
+        if (amt < 0)
+            return amt;
+        if (amt == 0)
+            return UV_EOF;
+        total += amt;
+    }
+    return 0;
+}
+
+static int write_at(uv_file fd, const char *src, int64_t size, int64_t offset) {
+    int64_t total = 0;
+    while (total < size) {
+        uv_buf_t buf = uv_buf_init(const_cast<char *>(src) + total, (unsigned int)(size - total));
+        uv_fs_t req;
+        int amt = uv_fs_write(uv_default_loop(), &req, fd, &buf, 1, offset + total, NULL);
+        uv_fs_req_cleanup(&req);
+        if (amt < 0)
+            return amt;
+        total += amt;
+    }
+    return 0;
+}
+
+static uint32_t get_le32(const char *p) {
+    const unsigned char *u = reinterpret_cast<const unsigned char *>(p);
+    return u[0] | (u[1] << 8) | (u[2] << 16) | ((uint32_t)u[3] << 24);
+}
+
+static void put_le32(std::string *out, uint32_t x) {
+    char b[4] = {(char)(x & 0xff), (char)((x >> 8) & 0xff), (char)((x >> 16) & 0xff), (char)(x >> 24)};
+    out->append(b, 4);
+}
+
+static void put_block_header(std::string *out, int type, bool last, int64_t size) {
+    out->push_back((char)((last ? 0x80 : 0) | type));
+    out->push_back((char)((size >> 16) & 0xff));
+    out->push_back((char)((size >> 8) & 0xff));
+    out->push_back((char)(size & 0xff));
+}
+
+static bool key_is(const std::string &comment, const char *key) {
+    size_t len = strlen(key);
+    if (comment.size() <= len || comment[len] != '=')
+        return false;
+    for (size_t i = 0; i < len; i += 1) {
+        if (toupper((unsigned char)comment[i]) != key[i])
+            return false;
+    }
+    return true;
+}
+
+// Splits a Vorbis comment block into its vendor string and the comments
+// which libavformat does not expose as metadata, which must be kept.
+static bool parse_vorbis_comment(const std::string &block, std::string *vendor,
+        std::vector<std::string> *kept)
+{
+    const char *p = block.data();
+    const char *end = p + block.size();
+    if (end - p < 4)
+        return false;
+    uint32_t vendor_len = get_le32(p);
+    p += 4;
+    if ((uint32_t)(end - p) < vendor_len)
+        return false;
+    vendor->assign(p, vendor_len);
+    p += vendor_len;
+    if (end - p < 4)
+        return false;
+    uint32_t count = get_le32(p);
+    p += 4;
+    for (uint32_t i = 0; i < count; i += 1) {
+        if (end - p < 4)
+            return false;
+        uint32_t len = get_le32(p);
+        p += 4;
+        if ((uint32_t)(end - p) < len)
+            return false;
+        std::string comment(p, len);
+        p += len;
+        // cover art is turned into an attached picture stream
+        if (key_is(comment, "METADATA_BLOCK_PICTURE"))
+            kept->push_back(comment);
+    }
+    return true;
+}
+
+static int save_flac(GrooveFile *file, uv_file fd) {
+    char magic[4];
+    int err;
+    if ((err = read_at(fd, magic, 4, 0)))
+        return (err == UV_EOF) ? 0 : err;
+    if (memcmp(magic, "fLaC", 4) != 0)
+        return 0;
+
+    std::vector<FlacBlock> blocks;
+    int64_t offset = 4;
+    for (;;) {
+        if ((int)blocks.size() >= flac_max_blocks)
+            return 0;
+        unsigned char h[4];
+        if ((err = read_at(fd, reinterpret_cast<char *>(h), 4, offset)))
+            return (err == UV_EOF) ? 0 : err;
+        FlacBlock block;
+        block.offset = offset;
+        block.last = (h[0] & 0x80);
+        block.type = h[0] & 0x7f;
+        block.size = (h[1] << 16) | (h[2] << 8) | h[3];
+        blocks.push_back(block);
+        offset += 4 + block.size;
+        if (block.last)
+            break;
+    }
+
+    int comment_index = -1;
+    for (size_t i = 0; i < blocks.size(); i += 1) {
+        if (blocks[i].type == flac_block_vorbis_comment) {
+            comment_index = (int)i;
+            break;
+        }
+    }
+    if (comment_index == -1)
+        return 0;
+
+    int first = comment_index;
+    while (first > 0 && blocks[first - 1].type == flac_block_padding)
+        first -= 1;
+    int last = comment_index;
+    while (last + 1 < (int)blocks.size() && blocks[last + 1].type == flac_block_padding)
+        last += 1;
+    int64_t region_start = blocks[first].offset;
+    int64_t region_size = blocks[last].offset + 4 + blocks[last].size - region_start;
+    bool region_is_last = blocks[last].last;
+
+    const FlacBlock &comment_block = blocks[comment_index];
+    std::string old_comment;
+    old_comment.resize(comment_block.size);
+    if (comment_block.size > 0 &&
+        (err = read_at(fd, &old_comment[0], comment_block.size, comment_block.offset + 4)))
+    {
+        return (err == UV_EOF) ? 0 : err;
+    }
+    std::string vendor;
+    std::vector<std::string> comments;
+    if (!parse_vorbis_comment(old_comment, &vendor, &comments))
+        return 0;
+
+    GrooveTag *tag = NULL;
+    while ((tag = groove_file_metadata_get(file, "", tag, 0))) {
+        const char *key = groove_tag_key(tag);
+        const char *value = groove_tag_value(tag);
+        // libavformat reports the vendor string as the encoder
+        if (strcmp(key, "encoder") == 0 && vendor == value)
+            continue;
+        comments.push_back(std::string(vorbis_comment_key(key)) + "=" + value);
+    }
+
+    std::string payload;
+    put_le32(&payload, (uint32_t)vendor.size());
+    payload.append(vendor);
+    put_le32(&payload, (uint32_t)comments.size());
+    for (size_t i = 0; i < comments.size(); i += 1) {
+        put_le32(&payload, (uint32_t)comments[i].size());
+        payload.append(comments[i]);
+    }
+
+    int64_t leftover = region_size - 4 - (int64_t)payload.size();
+    // a padding block needs room for its own header
+    if (leftover < 0 || (leftover > 0 && leftover < 4) || (int64_t)payload.size() > flac_max_block_size)
+        return 0;
+    int64_t padding_size = leftover - 4;
+    if (padding_size > flac_max_block_size)
+        return 0;
+
+    std::string region;
+    region.reserve(region_size);
+    put_block_header(&region, flac_block_vorbis_comment, region_is_last && leftover == 0,
+            payload.size());
+    region.append(payload);
+    if (leftover > 0) {
+        put_block_header(&region, flac_block_padding, region_is_last, padding_size);
+        region.append(padding_size, '\0');
+    }
+
+    if ((err = write_at(fd, region.data(), region.size(), region_start)))
+        return err;
+    return 1;
+}
+
+int tag_writer_save_in_place(GrooveFile *file, const char *path) {
+    if (strcmp(groove_file_short_names(file), "flac") != 0)
+        return 0;
+
+    uv_fs_t req;
+    uv_file fd = uv_fs_open(uv_default_loop(), &req, path, O_RDWR, 0, NULL);
+    uv_fs_req_cleanup(&req);
+    if (fd < 0)
+        return fd;
+
+    int result = save_flac(file, fd);
+
+    int err = uv_fs_close(uv_default_loop(), &req, fd, NULL);
+    uv_fs_req_cleanup(&req);
+    if (result == 1 && err)
+        return err;
+    return result;
+}
+
+static int sync_path(const char *path) {
+    uv_fs_t req;
+    uv_file fd = uv_fs_open(uv_default_loop(), &req, path, O_RDONLY, 0, NULL);
+    uv_fs_req_cleanup(&req);
+    if (fd < 0)
+        return fd;
+    int err = uv_fs_fsync(uv_default_loop(), &req, fd, NULL);
+    uv_fs_req_cleanup(&req);
+    uv_fs_close(uv_default_loop(), &req, fd, NULL);
+    uv_fs_req_cleanup(&req);
+    return err;
+}
+
+int tag_writer_sync(const char *filename, bool sync_dir) {
+    int err;
+    if ((err = sync_path(filename)))
+        return err;
+#ifndef _WIN32
+    if (sync_dir) {
+        std::string dir(filename);
+        size_t slash = dir.rfind('/');
+        dir = (slash == std::string::npos) ? "." : dir.substr(0, slash + 1);
+        if ((err = sync_path(dir.c_str())))
+            return err;
+    }
+#endif
+    return 0;
+}
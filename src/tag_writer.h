@@ -0,0 +1,20 @@
+#ifndef GN_TAG_WRITER_H
+#define GN_TAG_WRITER_H
+
+#include <groove/groove.h>
+
+// Writes the metadata of file into path, the file on disk it was opened
+// from, without touching the audio data. This is possible
+// for FLAC files whose Vorbis comment block, together with the padding next
+// to it, is big enough to hold the new tags.
+// Returns 1 if the tags were written, 0 if the file has to be remuxed
+// instead, or a negative libuv error code. file->dirty is left alone, since
+// JavaScript may be reading it; the caller clears it on the main thread.
+int tag_writer_save_in_place(GrooveFile *file, const char *path);
+
+// Flushes filename to disk. When sync_dir is set, also flushes the directory
+// containing it so that a preceding rename is durable.
+// Returns 0 or a negative libuv error code.
+int tag_writer_sync(const char *filename, bool sync_dir);
+
+#endif
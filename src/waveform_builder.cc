@@ -1,18 +1,29 @@
 #include "waveform_builder.h"
+#include "env.h"
 #include "playlist.h"
 #include "playlist_item.h"
 #include "groove.h"
+#include "scheduler.h"
+#include "cancel_token.h"
+#include "event_dispatcher.h"
 
 using namespace v8;
 
 GNWaveformBuilder::GNWaveformBuilder() {};
 GNWaveformBuilder::~GNWaveformBuilder() {
+    if (event_context->event_source)
+        event_dispatcher_remove(event_context->event_source);
+    position_view_destroy(event_context->position_view);
     groove_waveform_destroy(waveform);
     delete event_context->event_cb;
     delete event_context;
 };
 
-static Nan::Persistent<v8::Function> constructor;
+static GNEnvPersistent<v8::Function> constructor;
+
+static void PositionFn(void *sink, GroovePlaylistItem **item, double *pos) {
+    groove_waveform_position(reinterpret_cast<GrooveWaveform *>(sink), item, pos);
+}
 
 void GNWaveformBuilder::Init() {
     // Prepare constructor template
@@ -30,6 +41,7 @@ void GNWaveformBuilder::Init() {
     Nan::SetPrototypeMethod(tpl, "detach", Detach);
     Nan::SetPrototypeMethod(tpl, "getInfo", GetInfo);
     Nan::SetPrototypeMethod(tpl, "position", Position);
+    Nan::SetPrototypeMethod(tpl, "positionView", PositionView);
 
     constructor.Reset(tpl->GetFunction());
 }
@@ -46,7 +58,7 @@ NAN_METHOD(GNWaveformBuilder::New) {
 Local<Value> GNWaveformBuilder::NewInstance(GrooveWaveform *waveform) {
     Nan::EscapableHandleScope scope;
 
-    Local<Function> cons = Nan::New(constructor);
+    Local<Function> cons = constructor.Get();
     Local<Object> instance = cons->NewInstance();
 
     GNWaveformBuilder *gn_waveform = node::ObjectWrap::Unwrap<GNWaveformBuilder>(instance);
@@ -118,6 +130,8 @@ NAN_METHOD(GNWaveformBuilder::Create) {
     gn_waveform->event_context = context;
     context->event_cb = new Nan::Callback(info[0].As<Function>());
     context->waveform = waveform;
+    context->event_source = NULL;
+    context->position_view = position_view_create(waveform, PositionFn);
 
 
     Nan::Set(instance, Nan::New<String>("infoQueueSizeBytes").ToLocalChecked(),
@@ -174,10 +188,15 @@ NAN_METHOD(GNWaveformBuilder::GetInfo) {
     }
 }
 
-static void EventAsyncCb(uv_async_t *handle) {
+static bool EventPoll(void *arg) {
+    GNWaveformBuilder::EventContext *context = reinterpret_cast<GNWaveformBuilder::EventContext *>(arg);
+    return groove_waveform_info_peek(context->waveform, 0) > 0;
+}
+
+static void EventFlush(void *arg) {
     Nan::HandleScope scope;
 
-    GNWaveformBuilder::EventContext *context = reinterpret_cast<GNWaveformBuilder::EventContext *>(handle->data);
+    GNWaveformBuilder::EventContext *context = reinterpret_cast<GNWaveformBuilder::EventContext *>(arg);
 
     // call callback signaling that there is info ready
 
@@ -191,55 +210,46 @@ static void EventAsyncCb(uv_async_t *handle) {
     if (try_catch.HasCaught()) {
         node::FatalException(try_catch);
     }
-
-    uv_mutex_lock(&context->mutex);
-    uv_cond_signal(&context->cond);
-    uv_mutex_unlock(&context->mutex);
-}
-
-static void EventThreadEntry(void *arg) {
-    GNWaveformBuilder::EventContext *context = reinterpret_cast<GNWaveformBuilder::EventContext *>(arg);
-    while (groove_waveform_info_peek(context->waveform, 1) > 0) {
-        uv_mutex_lock(&context->mutex);
-        uv_async_send(&context->event_async);
-        uv_cond_wait(&context->cond, &context->mutex);
-        uv_mutex_unlock(&context->mutex);
-    }
 }
 
 class WaveformAttachWorker : public Nan::AsyncWorker {
 public:
     WaveformAttachWorker(Nan::Callback *callback, GrooveWaveform *waveform, GroovePlaylist *playlist,
-            GNWaveformBuilder::EventContext *event_context) :
+            GNWaveformBuilder::EventContext *event_context, GNCancelState *cancel) :
         Nan::AsyncWorker(callback)
     {
         this->waveform = waveform;
         this->playlist = playlist;
         this->event_context = event_context;
+        this->cancel = cancel;
+    }
+    ~WaveformAttachWorker() {
+        cancel_state_unref(cancel);
     }
-    ~WaveformAttachWorker() {}
 
     void Execute() {
+        if (cancel_state_is_cancelled(cancel)) {
+            SetErrorMessage("cancelled");
+            return;
+        }
         int err;
         if ((err = groove_waveform_attach(waveform, playlist))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
 
-        GNWaveformBuilder::EventContext *context = event_context;
-
-        uv_cond_init(&context->cond);
-        uv_mutex_init(&context->mutex);
-
-        context->event_async.data = context;
-        uv_async_init(uv_default_loop(), &context->event_async, EventAsyncCb);
+        position_view_attach(event_context->position_view, playlist);
+    }
 
-        uv_thread_create(&context->event_thread, EventThreadEntry, context);
+    void HandleOKCallback() {
+        event_context->event_source = event_dispatcher_add(EventPoll, EventFlush, event_context);
+        Nan::AsyncWorker::HandleOKCallback();
     }
 
     GrooveWaveform *waveform;
     GroovePlaylist *playlist;
     GNWaveformBuilder::EventContext *event_context;
+    GNCancelState *cancel;
 };
 
 NAN_METHOD(GNWaveformBuilder::Attach) {
@@ -251,11 +261,11 @@ NAN_METHOD(GNWaveformBuilder::Attach) {
         Nan::ThrowTypeError("Expected object arg[0]");
         return;
     }
-    if (info.Length() < 2 || !info[1]->IsFunction()) {
-        Nan::ThrowTypeError("Expected function arg[1]");
+    GNCancelState *cancel;
+    int cb_index = GNCancelToken::ParseOptions(info, 1, &cancel);
+    if (cb_index < 0)
         return;
-    }
-    Nan::Callback *callback = new Nan::Callback(info[1].As<Function>());
+    Nan::Callback *callback = new Nan::Callback(info[cb_index].As<Function>());
 
     Local<Object> instance = info.This();
 
@@ -268,7 +278,7 @@ NAN_METHOD(GNWaveformBuilder::Attach) {
     waveform->width_in_frames = (int)instance->Get(Nan::New<String>("widthInFrames").ToLocalChecked())->NumberValue();
 
 
-    AsyncQueueWorker(new WaveformAttachWorker(callback, waveform, gn_playlist->playlist, gn_waveform->event_context));
+    scheduler_queue(new WaveformAttachWorker(callback, waveform, gn_playlist->playlist, gn_waveform->event_context, cancel), GNPriorityInteractive);
 }
 
 class WaveformDetachWorker : public Nan::AsyncWorker {
@@ -284,15 +294,11 @@ public:
 
     void Execute() {
         int err;
+        position_view_detach(event_context->position_view);
         if ((err = groove_waveform_detach(waveform))) {
             SetErrorMessage(groove_strerror(err));
             return;
         }
-        uv_cond_signal(&event_context->cond);
-        uv_thread_join(&event_context->event_thread);
-        uv_cond_destroy(&event_context->cond);
-        uv_mutex_destroy(&event_context->mutex);
-        uv_close(reinterpret_cast<uv_handle_t*>(&event_context->event_async), NULL);
     }
 
     GrooveWaveform *waveform;
@@ -312,5 +318,17 @@ NAN_METHOD(GNWaveformBuilder::Detach) {
     GNWaveformBuilder *gn_waveform = node::ObjectWrap::Unwrap<GNWaveformBuilder>(info.This());
     GrooveWaveform *waveform = gn_waveform->waveform;
 
-    AsyncQueueWorker(new WaveformDetachWorker(callback, waveform, gn_waveform->event_context));
+    // stop delivering events now rather than when the detach finishes
+    if (gn_waveform->event_context->event_source) {
+        event_dispatcher_remove(gn_waveform->event_context->event_source);
+        gn_waveform->event_context->event_source = NULL;
+    }
+
+    scheduler_queue(new WaveformDetachWorker(callback, waveform, gn_waveform->event_context), GNPriorityInteractive);
+}
+
+NAN_METHOD(GNWaveformBuilder::PositionView) {
+    Nan::HandleScope scope;
+    GNWaveformBuilder *gn_waveform = node::ObjectWrap::Unwrap<GNWaveformBuilder>(info.This());
+    info.GetReturnValue().Set(position_view_get_array(gn_waveform->event_context->position_view));
 }
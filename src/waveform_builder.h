@@ -4,6 +4,8 @@
 #include <node.h>
 #include <nan.h>
 #include <groove/waveform.h>
+#include "position_view.h"
+#include "event_dispatcher.h"
 
 class GNWaveformBuilder : public node::ObjectWrap {
     public:
@@ -13,12 +15,10 @@ class GNWaveformBuilder : public node::ObjectWrap {
         static NAN_METHOD(Create);
 
         struct EventContext {
-            uv_thread_t event_thread;
-            uv_async_t event_async;
-            uv_cond_t cond;
-            uv_mutex_t mutex;
+            GNEventSource *event_source;
             GrooveWaveform *waveform;
             Nan::Callback *event_cb;
+            GNPositionView *position_view;
         };
 
         EventContext *event_context;
@@ -37,6 +37,7 @@ class GNWaveformBuilder : public node::ObjectWrap {
         static NAN_METHOD(Detach);
         static NAN_METHOD(GetInfo);
         static NAN_METHOD(Position);
+        static NAN_METHOD(PositionView);
 };
 
 #endif
@@ -2,10 +2,13 @@ var groove = require('../');
 var assert = require('assert');
 var path = require('path');
 var fs = require('fs');
+var PassThrough = require('stream').PassThrough;
 var ncp = require('ncp').ncp;
 var testOgg = path.join(__dirname, "danse.ogg");
 var bogusFile = __filename;
 var rwTestOgg = path.join(__dirname, "danse-rw.ogg");
+var testFlac = path.join(__dirname, "silence.flac");
+var rwTestFlac = path.join(__dirname, "silence-rw.flac");
 var it = global.it;
 
 it("version", function() {
@@ -15,11 +18,29 @@ it("version", function() {
   assert.strictEqual(typeof ver.patch, 'number');
 });
 
+it("init without audio", function() {
+    groove.init({audio: false});
+    assert.throws(function() {
+        groove.createPlayer();
+    }, /audio is disabled/);
+    assert.throws(function() {
+        groove.getDevices();
+    }, /audio is disabled/);
+    groove.init({audio: true});
+});
+
 it("logging", function() {
     assert.strictEqual(groove.LOG_ERROR, 16);
     groove.setLogging(groove.LOG_QUIET);
 });
 
+it("scheduler thread count", function() {
+    groove.setSchedulerThreadCount(4);
+    assert.throws(function() {
+        groove.setSchedulerThreadCount(0);
+    });
+});
+
 it("open fails for bogus file", function(done) {
     groove.open(bogusFile, function(err, file) {
         assert.strictEqual(err.message, "unknown format");
@@ -45,6 +66,299 @@ it("open file and read metadata", function(done) {
     });
 });
 
+it("open file with format hint", function(done) {
+    var options = {formatHint: "ogg", probeSizeBytes: 64 * 1024, priority: "background"};
+    groove.open(testOgg, options, function(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.metadata().TITLE, 'Danse Macabre');
+        assert.strictEqual(file.shortNames(), 'ogg');
+        assert.strictEqual(file.filename, testOgg);
+        file.close(function(err) {
+            if (err) throw err;
+            done();
+        });
+    });
+});
+
+it("cancel open", function(done) {
+    var token = groove.createCancelToken();
+    assert.strictEqual(token.cancelled, false);
+    token.cancel();
+    assert.strictEqual(token.cancelled, true);
+    groove.open(testOgg, {cancelToken: token}, function(err, file) {
+        assert.strictEqual(err.message, "cancelled");
+        assert.ok(!file);
+        done();
+    });
+});
+
+it("cancel open of a stream while probing", function(done) {
+    var token = groove.createCancelToken();
+    var stream = new PassThrough();
+    groove.openStream(stream, "danse.ogg", {cancelToken: token}, function(err, file) {
+        assert.strictEqual(err.message, "cancelled");
+        assert.ok(!file);
+        stream.end();
+        done();
+    });
+    // not enough to recognize the format, so the open waits for more
+    stream.write(fs.readFileSync(testOgg).slice(0, 64));
+    setTimeout(function() {
+        token.cancel();
+    }, 50);
+});
+
+it("cancel after open still decodes", function(done) {
+    var token = groove.createCancelToken();
+    groove.open(testOgg, {cancelToken: token}, function(err, file) {
+        assert.ok(!err);
+        token.cancel();
+        var playlist = groove.createPlaylist();
+        var sink = groove.createNullSink();
+        sink.realTime = false;
+        sink.once('endOfPlaylist', function() {
+            assert.ok(Math.abs(sink.stats().audioDuration - file.duration()) < 0.1);
+            sink.detach(function(err) {
+                assert.ok(!err);
+                playlist.clear();
+                playlist.destroy();
+                file.close(done);
+            });
+        });
+        sink.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+        });
+    });
+});
+
+it("open file from buffer", function(done) {
+    groove.openBuffer(fs.readFileSync(testOgg), "danse.ogg", function(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.filename, "danse.ogg");
+        assert.strictEqual(file.metadata().TITLE, 'Danse Macabre');
+        assert.strictEqual(file.shortNames(), 'ogg');
+        file.close(function(err) {
+            if (err) throw err;
+            groove.openMapped(testOgg, checkMapped);
+        });
+    });
+    function checkMapped(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.metadata().ARTIST, 'Kevin MacLeod');
+        file.close(function(err) {
+            if (err) throw err;
+            done();
+        });
+    }
+});
+
+it("open file from buffer with an extension as the hint", function(done) {
+    groove.openBuffer(fs.readFileSync(testOgg), "ogg", function(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.filename, "hint.ogg");
+        assert.strictEqual(file.shortNames(), 'ogg');
+        file.close(done);
+    });
+});
+
+it("save refuses a file opened from a buffer", function(done) {
+    groove.openBuffer(fs.readFileSync(testOgg), "danse.ogg", function(err, file) {
+        assert.ok(!err);
+        file.setMetadata('TITLE', 'Quiet');
+        assert.throws(function() {
+            file.save(function() {
+                throw new Error("save should not run");
+            });
+        }, /not opened from a path/);
+        file.close(done);
+    });
+});
+
+it("open file from stream", function(done) {
+    var stream = fs.createReadStream(testOgg);
+    groove.openStream(stream, "danse.ogg", {bufferSize: 16 * 1024}, function(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.metadata().TITLE, 'Danse Macabre');
+        file.close(function(err) {
+            if (err) throw err;
+            done();
+        });
+    });
+});
+
+it("open file from stream with an extension as the hint", function(done) {
+    groove.openStream(fs.createReadStream(testOgg), "ogg", function(err, file) {
+        assert.ok(!err);
+        assert.strictEqual(file.filename, "hint.ogg");
+        assert.strictEqual(file.shortNames(), 'ogg');
+        file.close(done);
+    });
+});
+
+it("open file from a stream which errors", function(done) {
+    var stream = new PassThrough();
+    groove.openStream(stream, "danse.ogg", function(err, file) {
+        assert.ok(err);
+        assert.strictEqual(err.message, 'connection reset');
+        assert.ok(!file);
+        done();
+    });
+    stream.write(fs.readFileSync(testOgg).slice(0, 4096));
+    stream.emit('error', new Error('connection reset'));
+});
+
+it("file audio format", function(done) {
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var format = file.audioFormat();
+        assert.ok(format.sampleRate > 0);
+        assert.ok(format.channelLayout.length > 0);
+        assert.strictEqual(typeof format.sampleFormat, 'number');
+        file.close(done);
+    });
+});
+
+it("scan files", function(done) {
+    var results = [];
+    groove.scan([testOgg, bogusFile], {concurrency: 2, batchSize: 1}, function(batch) {
+        results = results.concat(batch);
+    }, function() {
+        assert.strictEqual(results.length, 2);
+        var ogg = results[0].filename === testOgg ? results[0] : results[1];
+        var bogus = results[0].filename === testOgg ? results[1] : results[0];
+        assert.strictEqual(ogg.err, null);
+        assert.strictEqual(ogg.metadata.TITLE, 'Danse Macabre');
+        assert.strictEqual(ogg.shortNames, 'ogg');
+        assert.ok(ogg.duration > 0);
+        assert.strictEqual(bogus.err.message, "unknown format");
+        done();
+    });
+});
+
+it("metadata cache", function(done) {
+    var cacheFile = path.join(__dirname, "metadata-cache.bin");
+    groove.openMetadataCache(cacheFile);
+    groove.open(testOgg, {metadataOnly: true}, function(err, file) {
+        assert.ok(!err);
+        // not cached yet so this is a real file
+        file.overrideDuration(file.duration());
+        file.close(function(err) {
+            assert.ok(!err);
+            groove.saveMetadataCache(checkCached);
+        });
+    });
+    function checkCached(err) {
+        assert.ok(!err);
+        groove.closeMetadataCache();
+        groove.openMetadataCache(cacheFile);
+        groove.open(testOgg, {metadataOnly: true}, function(err, file) {
+            assert.ok(!err);
+            assert.strictEqual(file.filename, testOgg);
+            assert.strictEqual(file.metadata().TITLE, 'Danse Macabre');
+            assert.strictEqual(file.getMetadata('initial key'), 'C');
+            assert.strictEqual(file.shortNames(), 'ogg');
+            assert.throws(function() {
+                file.overrideDuration(1);
+            });
+            file.close(function(err) {
+                assert.ok(!err);
+                groove.closeMetadataCache();
+                fs.unlinkSync(cacheFile);
+                done();
+            });
+        });
+    }
+});
+
+it("truncated metadata cache is ignored", function(done) {
+    var cacheFile = path.join(__dirname, "metadata-cache-truncated.bin");
+    groove.openMetadataCache(cacheFile);
+    groove.open(testOgg, {metadataOnly: true}, function(err, file) {
+        assert.ok(!err);
+        file.close(function(err) {
+            assert.ok(!err);
+            groove.saveMetadataCache(truncate);
+        });
+    });
+    function truncate(err) {
+        assert.ok(!err);
+        groove.closeMetadataCache();
+        fs.truncateSync(cacheFile, fs.statSync(cacheFile).size - 3);
+        groove.openMetadataCache(cacheFile);
+        groove.open(testOgg, {metadataOnly: true}, function(err, file) {
+            assert.ok(!err);
+            // a real file, not a cache entry
+            file.overrideDuration(file.duration());
+            file.close(function(err) {
+                assert.ok(!err);
+                groove.closeMetadataCache();
+                fs.unlinkSync(cacheFile);
+                done();
+            });
+        });
+    }
+});
+
+it("file pool", function(done) {
+    var pool = groove.createFilePool({maxOpen: 1});
+    pool.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var id = file.id;
+        assert.strictEqual(file.metadata().TITLE, 'Danse Macabre');
+        file.close(function(err) {
+            assert.ok(!err);
+            assert.strictEqual(pool.stats().idle, 1);
+            pool.open(testOgg, function(err, file) {
+                assert.ok(!err);
+                // the same handle is reused
+                assert.strictEqual(file.id, id);
+                assert.strictEqual(pool.stats().idle, 0);
+                file.close(function(err) {
+                    assert.ok(!err);
+                    pool.clear(function(err) {
+                        assert.ok(!err);
+                        assert.strictEqual(pool.stats().open, 0);
+                        done();
+                    });
+                });
+            });
+        });
+    });
+});
+
+it("compute exact duration", function(done) {
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var containerDuration = file.duration();
+        file.computeExactDuration({fast: true}, function(err, duration) {
+            assert.ok(!err);
+            assert.ok(Math.abs(duration - containerDuration) < 0.1);
+            assert.strictEqual(file.duration(), duration);
+            file.close(function(err) {
+                if (err) throw err;
+                done();
+            });
+        });
+    });
+});
+
+it("exact duration of a file opened from memory", function(done) {
+    groove.openBuffer(fs.readFileSync(testOgg), "danse.ogg", function(err, file) {
+        assert.ok(!err);
+        var containerDuration = file.duration();
+        file.computeExactDuration(function(err, duration) {
+            assert.ok(!err);
+            assert.ok(Math.abs(duration - containerDuration) < 0.1);
+            file.close(done);
+        });
+        // the decoder reads through the file's buffer until it is done
+        assert.throws(function() {
+            file.close(function() {});
+        }, /busy/);
+    });
+});
+
 it("update metadata", function(done) {
     ncp(testOgg, rwTestOgg, function(err) {
         assert.ok(!err);
@@ -54,8 +368,9 @@ it("update metadata", function(done) {
         if (err) throw err;
         file.setMetadata('foo new key', "libgroove rules!");
         assert.strictEqual(file.getMetadata('foo new key'), 'libgroove rules!');
-        file.save(function(err) {
+        file.save(function(err, result) {
             if (err) throw err;
+            assert.strictEqual(result.method, 'remux');
             file.close(checkUpdate);
         });
     }
@@ -70,6 +385,133 @@ it("update metadata", function(done) {
     }
 });
 
+function flacPictureBlock(buffer) {
+    // the fixture has STREAMINFO and then PICTURE
+    var offset = 4 + 4 + 34;
+    assert.strictEqual(buffer[offset] & 0x7f, 6);
+    return buffer.slice(offset, offset + 4 + buffer.readUIntBE(offset + 1, 3));
+}
+
+it("update FLAC metadata in place", function(done) {
+    ncp(testFlac, rwTestFlac, function(err) {
+        assert.ok(!err);
+        groove.open(rwTestFlac, doUpdate);
+    });
+    function doUpdate(err, file) {
+        if (err) throw err;
+        file.setMetadata('TITLE', 'Quiet');
+        assert.strictEqual(file.dirty, true);
+        file.save(function(err, result) {
+            if (err) throw err;
+            assert.strictEqual(result.method, 'inPlace');
+            assert.strictEqual(file.dirty, false);
+            file.close(checkUpdate);
+        });
+    }
+    function checkUpdate(err) {
+        assert.ok(!err);
+        var before = fs.readFileSync(testFlac);
+        var after = fs.readFileSync(rwTestFlac);
+        assert.strictEqual(after.length, before.length);
+        assert.ok(flacPictureBlock(after).equals(flacPictureBlock(before)));
+        groove.open(rwTestFlac, function(err, file) {
+            assert.ok(!err);
+            assert.strictEqual(file.getMetadata('TITLE'), 'Quiet');
+            assert.strictEqual(file.getMetadata('ARTIST'), 'libgroove');
+            assert.ok(file.duration() > 1);
+            file.close(function(err) {
+                if (err) throw err;
+                fs.unlinkSync(rwTestFlac);
+                done();
+            });
+        });
+    }
+});
+
+it("update FLAC metadata in place after opening with a hint", function(done) {
+    var options = {formatHint: "flac", cancelToken: groove.createCancelToken()};
+    ncp(testFlac, rwTestFlac, function(err) {
+        assert.ok(!err);
+        groove.open(rwTestFlac, options, doUpdate);
+    });
+    function doUpdate(err, file) {
+        if (err) throw err;
+        assert.strictEqual(file.filename, rwTestFlac);
+        file.setMetadata('TITLE', 'Quiet');
+        file.save(function(err, result) {
+            if (err) throw err;
+            assert.strictEqual(result.method, 'inPlace');
+            file.close(function(err) {
+                if (err) throw err;
+                fs.unlinkSync(rwTestFlac);
+                done();
+            });
+        });
+    }
+});
+
+it("update FLAC metadata without enough padding", function(done) {
+    var longValue = new Array(4096).join('x');
+    ncp(testFlac, rwTestFlac, function(err) {
+        assert.ok(!err);
+        groove.open(rwTestFlac, doUpdate);
+    });
+    function doUpdate(err, file) {
+        if (err) throw err;
+        file.setMetadata('LYRICS', longValue);
+        file.save(function(err, result) {
+            if (err) throw err;
+            assert.strictEqual(result.method, 'remux');
+            file.close(checkUpdate);
+        });
+    }
+    function checkUpdate(err) {
+        assert.ok(!err);
+        groove.open(rwTestFlac, function(err, file) {
+            assert.ok(!err);
+            assert.strictEqual(file.getMetadata('LYRICS'), longValue);
+            assert.strictEqual(file.getMetadata('TITLE'), 'Silence');
+            file.close(function(err) {
+                if (err) throw err;
+                fs.unlinkSync(rwTestFlac);
+                done();
+            });
+        });
+    }
+});
+
+it("write tags", function(done) {
+    ncp(testOgg, rwTestOgg, function(err) {
+        assert.ok(!err);
+        var results = [];
+        var jobs = [
+            {path: rwTestOgg, tags: {'foo new key': 'bulk', 'initial key': null}},
+            {path: bogusFile, tags: {'foo new key': 'bulk'}},
+        ];
+        groove.writeTags(jobs, {concurrency: 2, fsync: true}, function(batch) {
+            results = results.concat(batch);
+        }, checkWritten);
+        function checkWritten() {
+            assert.strictEqual(results.length, 2);
+            var ogg = results[0].path === rwTestOgg ? results[0] : results[1];
+            var bogus = results[0].path === rwTestOgg ? results[1] : results[0];
+            assert.strictEqual(ogg.err, null);
+            assert.strictEqual(ogg.method, 'remux');
+            assert.strictEqual(bogus.err.message, "unknown format");
+            groove.open(rwTestOgg, function(err, file) {
+                assert.ok(!err);
+                assert.strictEqual(file.getMetadata('foo new key'), 'bulk');
+                assert.equal(file.getMetadata('initial key'), null);
+                file.close(function(err) {
+                    assert.ok(!err);
+                    fs.unlinkSync(rwTestOgg);
+                    done();
+                });
+            });
+        }
+    });
+});
+
 it("create empty playlist", function (done) {
     var playlist = groove.createPlaylist();
     assert.ok(playlist.id);
@@ -104,6 +546,253 @@ it("playlist item ids", function(done) {
     });
 });
 
+it("insert and remove many playlist items", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var first = playlist.insert(file);
+        var added = playlist.insertMany([{file: file}, {file: file, gain: 0.5}], first);
+        assert.strictEqual(added.length, 2);
+        var items = playlist.items();
+        assert.strictEqual(items.length, 3);
+        assert.strictEqual(items[0].id, added[0].id);
+        assert.strictEqual(items[1].id, added[1].id);
+        assert.strictEqual(items[1].gain, 0.5);
+        assert.strictEqual(items[2].id, first.id);
+        assert.throws(function() {
+            playlist.insertMany([{file: file}, {}]);
+        });
+        assert.strictEqual(playlist.count(), 3);
+        playlist.removeMany(added);
+        assert.strictEqual(playlist.count(), 1);
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("move and shuffle playlist items", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        playlist.insertMany([
+            {file: file, gain: 0.1},
+            {file: file, gain: 0.2},
+            {file: file, gain: 0.3},
+            {file: file, gain: 0.4},
+        ], null);
+        function gains() {
+            return playlist.items().map(function(item) { return item.gain; });
+        }
+        var items = playlist.items();
+        playlist.move(items[2], items[0]);
+        assert.deepEqual(gains(), [0.3, 0.1, 0.2, 0.4]);
+        playlist.shuffle(42);
+        var first = gains();
+        assert.strictEqual(first.length, 4);
+        assert.deepEqual(first.slice().sort(), [0.1, 0.2, 0.3, 0.4]);
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("shuffle leaves the items up to the decode head alone", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var items = playlist.insertMany([
+            {file: file, gain: 0.1},
+            {file: file, gain: 0.2},
+            {file: file, gain: 0.3},
+            {file: file, gain: 0.4},
+            {file: file, gain: 0.5},
+            {file: file, gain: 0.6},
+        ], null);
+        var ids = items.map(function(item) { return item.id; });
+        playlist.seek(items[2], 0);
+        assert.strictEqual(playlist.position().item, items[2]);
+        playlist.shuffle(42);
+        var shuffled = playlist.items();
+        for (var i = 0; i < 3; i += 1) {
+            assert.strictEqual(shuffled[i], items[i]);
+            assert.strictEqual(shuffled[i].id, ids[i]);
+        }
+        var rest = shuffled.slice(3).map(function(item) { return item.gain; });
+        assert.deepEqual(rest.sort(), [0.4, 0.5, 0.6]);
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("moved playlist items stay usable", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var items = playlist.insertMany([
+            {file: file, gain: 0.1},
+            {file: file, gain: 0.2},
+            {file: file, gain: 0.3},
+            {file: file, gain: 0.4},
+        ], null);
+        var oldId = items[2].id;
+        assert.strictEqual(playlist.move(items[2], items[1]), items[2]);
+        assert.notStrictEqual(items[2].id, oldId);
+        assert.strictEqual(playlist.itemById(oldId), null);
+        assert.strictEqual(playlist.itemById(items[2].id), items[2]);
+        assert.strictEqual(playlist.items()[1], items[2]);
+        assert.strictEqual(playlist.indexOf(items[2]), 1);
+        assert.strictEqual(items[2].file.filename, file.filename);
+        playlist.setItemGainPeak(items[2], 0.5, 1.0);
+        assert.strictEqual(items[2].gain, 0.5);
+
+        playlist.shuffle(7);
+        var shuffled = playlist.items();
+        items.forEach(function(item) {
+            assert.notStrictEqual(shuffled.indexOf(item), -1);
+            assert.strictEqual(playlist.indexOf(item), shuffled.indexOf(item));
+            assert.strictEqual(playlist.itemById(item.id), item);
+        });
+
+        var decoding = playlist.position().item;
+        if (decoding) {
+            assert.throws(function() {
+                playlist.move(decoding, null);
+            }, /being played/);
+        }
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("look up playlist items", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var added = playlist.insertMany([{file: file}, {file: file}], null);
+        var items = playlist.items();
+        assert.strictEqual(items[0], added[0]);
+        assert.strictEqual(items[1], playlist.items()[1]);
+        assert.strictEqual(playlist.itemById(items[1].id), items[1]);
+        assert.strictEqual(playlist.indexOf(items[1]), 1);
+        var removedId = items[0].id;
+        playlist.remove(items[0]);
+        assert.strictEqual(playlist.itemById(removedId), null);
+        assert.strictEqual(playlist.indexOf(items[0]), -1);
+        assert.strictEqual(playlist.indexOf(items[1]), 0);
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("removed playlist items are detached", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var removed = playlist.insert(file);
+        playlist.remove(removed);
+        assert.strictEqual(removed.id, null);
+        assert.strictEqual(removed.file, null);
+        // the freed item's memory is likely to be reused right away
+        var added = playlist.insert(file);
+        assert.notStrictEqual(added, removed);
+        assert.strictEqual(playlist.itemById(added.id), added);
+        assert.strictEqual(playlist.indexOf(removed), -1);
+        playlist.remove(removed);
+        assert.strictEqual(playlist.count(), 1);
+        assert.throws(function() {
+            playlist.seek(removed, 0);
+        }, /removed/);
+
+        var cleared = playlist.items();
+        playlist.clear();
+        assert.strictEqual(cleared[0].id, null);
+        playlist.destroy();
+        assert.strictEqual(added.id, null);
+        file.close(done);
+    });
+});
+
+it("page through playlist items", function(done) {
+    var playlist = groove.createPlaylist();
+    playlist.pause();
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var version = playlist.version;
+        var entries = [];
+        for (var i = 0; i < 10; i += 1) entries.push({file: file, gain: i});
+        var added = playlist.insertMany(entries, null);
+        assert.ok(playlist.version !== version);
+        var page = playlist.itemsRange(8, 5);
+        assert.strictEqual(page.length, 2);
+        assert.strictEqual(page[0], added[8]);
+        assert.strictEqual(playlist.itemsRange(20, 5).length, 0);
+        var gains = [];
+        var it = playlist.iterateItems(3);
+        for (var step = it.next(); !step.done; step = it.next()) {
+            gains.push(step.value.gain);
+            if (gains.length === 2) playlist.remove(added[5]);
+        }
+        assert.deepEqual(gains, [0, 1, 2, 3, 4, 6, 7, 8, 9]);
+        playlist.clear();
+        playlist.destroy();
+        file.close(done);
+    });
+});
+
+it("playlist position view", function(done) {
+    var playlist = groove.createPlaylist();
+    var view = playlist.positionView();
+    assert.strictEqual(view.length, 5);
+    assert.strictEqual(playlist.positionView(), view);
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var sink = groove.createNullSink();
+        sink.attach(playlist, function(err) {
+            assert.ok(!err);
+            var item = playlist.insert(file);
+            var position = {};
+            var firstPos = -1;
+            var lastPos = -1;
+            var start = Date.now();
+            poll();
+            function poll() {
+                groove.readPositionView(view, position);
+                if (position.itemId !== 0) {
+                    assert.strictEqual(playlist.itemById(position.itemId), item);
+                    assert.strictEqual(position.playing, true);
+                    assert.ok(position.pos >= lastPos);
+                    if (firstPos < 0) firstPos = position.pos;
+                    lastPos = position.pos;
+                }
+                if (Date.now() - start < 200) {
+                    setImmediate(poll);
+                    return;
+                }
+                assert.ok(lastPos > firstPos);
+                sink.detach(function(err) {
+                    assert.ok(!err);
+                    playlist.clear();
+                    playlist.destroy();
+                    assert.throws(function() {
+                        playlist.positionView();
+                    }, /destroyed/);
+                    file.close(done);
+                });
+            }
+        });
+    });
+});
+
 it("create, attach, detach player", function(done) {
     var playlist = groove.createPlaylist();
     var player = groove.createPlayer();
@@ -120,6 +809,127 @@ it("create, attach, detach player", function(done) {
     });
 });
 
+it("player device audio format", function(done) {
+    groove.connectSoundBackend(groove.BACKEND_DUMMY);
+    var devices = groove.getDevices();
+    var device = devices.list[devices.defaultIndex];
+    assert.ok(Array.isArray(device.formats));
+    assert.ok(Array.isArray(device.sampleRates));
+    assert.ok(Array.isArray(device.layouts));
+    var playlist = groove.createPlaylist();
+    var player = groove.createPlayer();
+    player.device = device;
+    assert.strictEqual(player.deviceAudioFormat(), null);
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var format = file.audioFormat();
+        player.once('nowPlaying', function() {
+            // the device is opened in the file's own format when it can be
+            if (device.supportsAudioFormat(format)) {
+                assert.deepEqual(player.deviceAudioFormat(), format);
+            } else {
+                assert.notStrictEqual(player.deviceAudioFormat(), null);
+            }
+            player.detach(function(err) {
+                assert.ok(!err);
+                assert.strictEqual(player.deviceAudioFormat(), null);
+                playlist.clear();
+                playlist.destroy();
+                groove.connectSoundBackend();
+                file.close(done);
+            });
+        });
+        player.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+        });
+    });
+});
+
+it("player stats", function(done) {
+    groove.connectSoundBackend(groove.BACKEND_DUMMY);
+    var devices = groove.getDevices();
+    var playlist = groove.createPlaylist();
+    var player = groove.createPlayer();
+    player.device = devices.list[devices.defaultIndex];
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        player.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+            setTimeout(function() {
+                var stats = player.stats();
+                assert.strictEqual(stats.underrunCount, 0);
+                assert.ok(stats.underrunDuration < 0.05);
+                assert.strictEqual(typeof stats.buffered, 'number');
+                assert.ok(stats.bufferedMin >= 0);
+                assert.strictEqual(stats.jitterHistogram.length, 7);
+                var advances = stats.jitterHistogram.reduce(function(a, b) {
+                    return a + b;
+                }, 0);
+                assert.ok(advances > 0);
+                player.detach(function(err) {
+                    assert.ok(!err);
+                    playlist.clear();
+                    playlist.destroy();
+                    groove.connectSoundBackend();
+                    file.close(done);
+                });
+            }, 300);
+        });
+    });
+});
+
+it("player with coalesced events", function(done) {
+    var playlist = groove.createPlaylist();
+    var player = groove.createPlayer({coalesceEvents: true});
+    groove.connectSoundBackend();
+    var devices = groove.getDevices();
+    player.device = devices.list[devices.defaultIndex];
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var item = playlist.insert(file);
+        player.once('events', function(events) {
+            assert.ok(events.length >= 1);
+            assert.strictEqual(typeof events[0].type, 'string');
+            assert.strictEqual(typeof events[0].time, 'number');
+            var nowPlaying = events.filter(function(event) {
+                return event.type === 'nowPlaying';
+            });
+            if (nowPlaying.length > 0 && nowPlaying[0].itemId !== 0) {
+                assert.strictEqual(playlist.itemById(nowPlaying[0].itemId), item);
+            }
+            player.detach(function(err) {
+                assert.ok(!err);
+                playlist.clear();
+                file.close(done);
+            });
+        });
+        player.attach(playlist, function(err) {
+            assert.ok(!err);
+        });
+    });
+});
+
+it("cached device list and devicesChanged", function(done) {
+    groove.connectSoundBackend();
+    var devices = groove.getDevices();
+    assert.strictEqual(groove.getDevices(), devices);
+    assert.ok(Object.isFrozen(devices));
+    assert.ok(Object.isFrozen(devices.list));
+    devices.list.forEach(function(device) {
+        assert.ok(Object.isFrozen(device));
+    });
+    groove.once('devicesChanged', function(change) {
+        assert.strictEqual(change.devices, null);
+        assert.strictEqual(change.added.length, 0);
+        assert.strictEqual(change.removed.length, devices.list.length);
+        groove.connectSoundBackend();
+        done();
+    });
+    groove.disconnectSoundBackend();
+});
+
 it("create, attach, detach loudness detector", function(done) {
   var playlist = groove.createPlaylist();
   var detector = groove.createLoudnessDetector();
@@ -132,6 +942,38 @@ it("create, attach, detach loudness detector", function(done) {
   });
 });
 
+it("many loudness detectors at once", function(done) {
+    var count = 8;
+    var remaining = count;
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        for (var i = 0; i < count; i += 1) {
+            startDetector();
+        }
+        function startDetector() {
+            var playlist = groove.createPlaylist();
+            var detector = groove.createLoudnessDetector();
+            detector.on('info', function() {
+                var info;
+                while ((info = detector.getInfo())) {
+                    if (info.item) continue;
+                    detector.detach(function(err) {
+                        assert.ok(!err);
+                        playlist.clear();
+                        playlist.destroy();
+                        remaining -= 1;
+                        if (remaining === 0) file.close(done);
+                    });
+                }
+            });
+            detector.attach(playlist, function(err) {
+                assert.ok(!err);
+                playlist.insert(file);
+            });
+        }
+    });
+});
+
 it("create, attach, detach encoder", function(done) {
     var playlist = groove.createPlaylist();
     var encoder = groove.createEncoder();
@@ -169,3 +1011,121 @@ it("create, attach, detach waveform builder", function(done) {
         });
     });
 });
+
+it("load in a worker thread", function(done) {
+    var worker_threads;
+    try {
+        worker_threads = require('worker_threads');
+    } catch (err) {
+        return this.skip();
+    }
+    var script =
+        "var groove = require(" + JSON.stringify(path.join(__dirname, '..')) + ");\n" +
+        "var parentPort = require('worker_threads').parentPort;\n" +
+        "groove.open(" + JSON.stringify(testOgg) + ", function(err, file) {\n" +
+        "    if (err) throw err;\n" +
+        "    var duration = file.duration();\n" +
+        "    file.close(function(err) {\n" +
+        "        if (err) throw err;\n" +
+        "        parentPort.postMessage(duration);\n" +
+        "    });\n" +
+        "});\n";
+    var worker = new worker_threads.Worker(script, {eval: true});
+    var duration = null;
+    worker.on('message', function(value) {
+        duration = value;
+    });
+    worker.on('error', done);
+    worker.on('exit', function() {
+        assert.ok(duration > 0);
+        groove.open(testOgg, function(err, file) {
+            assert.ok(!err);
+            file.close(done);
+        });
+    });
+});
+
+it("null sink consumes a playlist", function(done) {
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var playlist = groove.createPlaylist();
+        var sink = groove.createNullSink();
+        sink.realTime = false;
+        sink.once('endOfPlaylist', function() {
+            var stats = sink.stats();
+            assert.ok(stats.bufferCount > 0);
+            assert.ok(Math.abs(stats.audioDuration - file.duration()) < 0.1);
+            assert.strictEqual(stats.underrunCount, 0);
+            sink.detach(function(err) {
+                assert.ok(!err);
+                playlist.clear();
+                playlist.destroy();
+                file.close(done);
+            });
+        });
+        sink.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+        });
+    });
+});
+
+it("null sink target audio format", function(done) {
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var playlist = groove.createPlaylist();
+        var sink = groove.createNullSink();
+        assert.strictEqual(sink.targetAudioFormat, null);
+        var format = file.audioFormat();
+        sink.targetAudioFormat = {
+            sampleRate: format.sampleRate / 2,
+            channelLayout: format.channelLayout,
+            sampleFormat: format.sampleFormat,
+        };
+        sink.realTime = false;
+        sink.once('endOfPlaylist', function() {
+            var stats = sink.stats();
+            assert.ok(Math.abs(stats.audioDuration - file.duration()) < 0.1);
+            sink.detach(function(err) {
+                assert.ok(!err);
+                playlist.clear();
+                playlist.destroy();
+                file.close(done);
+            });
+        });
+        sink.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+        });
+    });
+});
+
+it("no sink events after detach", function(done) {
+    groove.open(testOgg, function(err, file) {
+        assert.ok(!err);
+        var playlist = groove.createPlaylist();
+        var sink = groove.createNullSink();
+        sink.realTime = false;
+        var events = 0;
+        sink.on('nowPlaying', onEvent);
+        sink.on('endOfPlaylist', onEvent);
+        sink.attach(playlist, function(err) {
+            assert.ok(!err);
+            playlist.insert(file);
+            playlist.insert(file);
+        });
+        function onEvent() {
+            events += 1;
+            if (events > 1) return;
+            sink.detach(function(err) {
+                assert.ok(!err);
+                setTimeout(function() {
+                    assert.strictEqual(events, 1);
+                    playlist.clear();
+                    playlist.destroy();
+                    file.close(done);
+                }, 50);
+            });
+        }
+    });
+});